@@ -0,0 +1,287 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace hipe {
+
+/**
+ * @brief Where the auto-scaling controller runs.
+ * own_thread: a thread of the controller that sleeps between the checks.
+ * piggyback: the workers and the producers run the check when they load or submit a task, no extra thread.
+ */
+enum class ScaleMode { own_thread,
+                       piggyback };
+
+
+// Options of the auto-scaling controller of DynamicThreadPond
+struct AutoScaleOptions {
+    // range of the thread number, zero max_threads means 4 times of the cpu number
+    int min_threads = 1;
+    int max_threads = 0;
+
+    // how often the pond is checked
+    std::chrono::milliseconds interval = std::chrono::milliseconds(5);
+
+    // the least time between two changes of growing or shrinking
+    // growing comes fast for the bursts, and shrinking comes slowly to avoid oscillating
+    std::chrono::milliseconds grow_cooldown = std::chrono::milliseconds(5);
+    std::chrono::milliseconds shrink_cooldown = std::chrono::milliseconds(1000);
+
+    // (default policy) grow if the busy threads can't drain the queue in this time
+    std::chrono::milliseconds drain_target = std::chrono::milliseconds(10);
+
+    // (default policy) shrink if the threads are busy for less than this ratio of time,
+    // and keep the threads left busy for about target_utilization of time
+    double shrink_utilization = 0.5;
+    double target_utilization = 0.75;
+
+    ScaleMode mode = ScaleMode::own_thread;
+};
+
+
+// What the controller saw in the last interval, given to the policy
+struct ScaleSample {
+    // expected thread number now
+    int threads = 0;
+
+    // tasks waiting in the queue, and the threads running tasks now
+    int queued = 0;
+    int busy = 0;
+
+    // average ratio of the time the threads spent on tasks, blocked in a task included
+    double utilization = 0.0;
+
+    // tasks loaded by the threads per second
+    double rate = 0.0;
+
+    // length of the interval in seconds
+    double window = 0.0;
+};
+
+
+/**
+ * @brief Scaling policy, return the thread number wanted.
+ * The controller clamps it into [min_threads, max_threads] and applies the cooldowns.
+ */
+using ScalePolicy = std::function<int(const ScaleSample&)>;
+
+
+namespace util {
+
+/**
+ * Default scaling policy.
+ * Grow to the number of threads that drains the queue within the drain target at the rate measured per busy
+ * thread, so the tasks blocking their threads make the pond grow more. Shrink when the threads are idle for a long
+ * time. There is a dead band between the two, in which the thread number stays.
+ */
+class DrainPolicy
+{
+    double drain_target;
+    double shrink_utilization;
+    double target_utilization;
+
+public:
+    explicit DrainPolicy(const AutoScaleOptions& options)
+      : drain_target(std::chrono::duration<double>(options.drain_target).count())
+      , shrink_utilization(options.shrink_utilization)
+      , target_utilization(options.target_utilization) {
+    }
+
+    int operator()(const ScaleSample& s) const {
+        if (s.queued > 0) {
+            double busy = std::max(s.utilization * s.threads, static_cast<double>(s.busy));
+            if (s.rate <= 0.0 || busy <= 0.0) {
+                // no task finished, the threads are held by long tasks
+                return s.threads + std::max(1, s.threads / 2);
+            }
+            double per_thread = s.rate / busy;
+            double need = busy + s.queued / (per_thread * drain_target);
+            need = std::min(need, busy + s.queued);
+            return std::max(s.threads, static_cast<int>(std::ceil(need)));
+        }
+        if (s.utilization < shrink_utilization) {
+            return static_cast<int>(std::ceil(s.utilization * s.threads / target_utilization));
+        }
+        return s.threads;
+    }
+};
+
+
+/**
+ * Controller of the auto-scaling.
+ * It takes a sample of the pond at most once an interval, asks the policy and adjusts the pond.
+ * Only one thread runs the check at the same time, the others return immediately.
+ */
+class AutoScaler
+{
+public:
+    using Probe = std::function<ScaleSample(double window)>;
+    using Adjust = std::function<void(int target)>;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    AutoScaleOptions opt;
+    ScalePolicy policy;
+    Probe probe;
+    Adjust adjust;
+
+    std::atomic<bool> enabled = {false};
+    std::atomic<bool> piggyback = {false};
+    std::atomic<Clock::rep> next_check = {0};
+    Clock::time_point last_check;
+    Clock::time_point last_change;
+
+    // held by the thread running the check
+    std::mutex check_locker;
+
+    bool stop = false;
+    std::mutex locker;
+    std::condition_variable awake_cv;
+    std::thread handle;
+
+    // nice value of the controller thread
+    static constexpr int controller_nice = 10;
+
+public:
+    AutoScaler(Probe probe_, Adjust adjust_)
+      : probe(std::move(probe_))
+      , adjust(std::move(adjust_)) {
+    }
+
+    ~AutoScaler() {
+        close();
+    }
+
+    // start or restart with new options, a null policy means the default one
+    void enable(const AutoScaleOptions& options, ScalePolicy scale_policy) {
+        close();
+        {
+            std::lock_guard<std::mutex> lock(check_locker);
+            opt = options;
+            if (opt.max_threads <= 0) {
+                opt.max_threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) * 4);
+            }
+            opt.min_threads = std::max(0, std::min(opt.min_threads, opt.max_threads));
+            policy = scale_policy ? std::move(scale_policy) : ScalePolicy(DrainPolicy(opt));
+            piggyback.store(opt.mode == ScaleMode::piggyback);
+            last_check = last_change = Clock::now();
+            next_check.store((last_check + opt.interval).time_since_epoch().count());
+        }
+        enabled.store(true);
+        if (opt.mode == ScaleMode::own_thread) {
+            stop = false;
+            handle = std::thread(&AutoScaler::worker, this);
+        }
+    }
+
+    // stop scaling, the thread number stays as it is
+    void close() {
+        enabled.store(false);
+        {
+            std::lock_guard<std::mutex> lock(locker);
+            stop = true;
+        }
+        awake_cv.notify_one();
+        if (handle.joinable()) {
+            handle.join();
+        }
+        // wait for the check running
+        std::lock_guard<std::mutex> lock(check_locker);
+    }
+
+    bool isEnabled() const {
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    const AutoScaleOptions& options() const {
+        return opt;
+    }
+
+    // (piggyback mode) run the check if it is time, cheap enough to be called for every task
+    void poll() {
+        if (piggyback.load(std::memory_order_relaxed) && enabled.load(std::memory_order_relaxed) &&
+            Clock::now().time_since_epoch().count() >= next_check.load(std::memory_order_relaxed)) {
+            check();
+        }
+    }
+
+    // clamp the target into the range
+    int clamp(int target) const {
+        return std::max(opt.min_threads, std::min(target, opt.max_threads));
+    }
+
+private:
+    void check() {
+        std::unique_lock<std::mutex> lock(check_locker, std::try_to_lock);
+        if (!lock.owns_lock() || !enabled.load()) {
+            return;
+        }
+        auto now = Clock::now();
+        if (now.time_since_epoch().count() < next_check.load()) {
+            return;
+        }
+        next_check.store((now + opt.interval).time_since_epoch().count());
+        double window = std::chrono::duration<double>(now - last_check).count();
+        last_check = now;
+
+        ScaleSample sample = probe(window);
+        if (clamp(sample.threads) != sample.threads) {
+            // out of the range, which comes from the options changed or adjusting by hand
+            adjust(clamp(sample.threads));
+            last_change = now;
+            return;
+        }
+        int target = clamp(policy(sample));
+        if (target > sample.threads && now - last_change >= opt.grow_cooldown) {
+            adjust(target);
+            last_change = now;
+        } else if (target < sample.threads && now - last_change >= opt.shrink_cooldown) {
+            // shrink by half of the gap each time, in case the load comes back
+            adjust(std::max(target, sample.threads - (sample.threads - target + 1) / 2));
+            last_change = now;
+        }
+    }
+
+    /**
+     * Lower the priority of the controller thread, so that its checks give way to the workers under heavy load.
+     * It is niced rather than made SCHED_IDLE, which could starve the check when the pond needs to grow the most.
+     * No-op on the other platforms.
+     */
+    static void lowerPriority() {
+#if defined(__linux__)
+        // the nice value of a thread id only changes the thread on Linux
+        setpriority(PRIO_PROCESS, static_cast<id_t>(syscall(SYS_gettid)), controller_nice);
+#endif
+    }
+
+    void worker() {
+        lowerPriority();
+        std::unique_lock<std::mutex> lock(locker);
+        while (!stop) {
+            awake_cv.wait_for(lock, opt.interval, [this] { return stop; });
+            if (stop) {
+                break;
+            }
+            lock.unlock();
+            check();
+            lock.lock();
+        }
+    }
+};
+
+} // namespace util
+
+} // namespace hipe
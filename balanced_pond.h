@@ -3,13 +3,52 @@
 
 namespace hipe {
 
+/**
+ * @brief Priority of the tasks submitted to BalancedThreadPond.
+ * The tasks submitted without priority are normal ones.
+ */
+enum class TaskPriority : int { high = 0, normal = 1, low = 2 };
+
+
 class OqThread : public ThreadBase
 {
     HipeTask task;
     std::queue<HipeTask> tq;
     util::spinlock tq_locker = {};
 
+    // Preallocated lock-free queue that replaces "tq" if the capacity is limited.
+    // Producers push without locking, "tq_locker" only protects the consumer side then.
+    util::RingBuffer<HipeTask> ring_tq;
+
+    // lanes of the high and low priority tasks, protected by "tq_locker"
+    std::queue<HipeTask> high_tq;
+    std::queue<HipeTask> low_tq;
+
+    // number of tasks in the high and low lanes, so that the normal path can skip the lanes without locking
+    std::atomic_int prior_numb = {0};
+
+    // rounds the normal and low lanes have been passed over while they have tasks, only accessed by the thread itself
+    int aging[3] = {0, 0, 0};
+
+    // a lower lane passed over for so many rounds will run one task before the higher lanes
+    static constexpr int aging_limit = 8;
+
 public:
+    // use a ring buffer that can hold "capacity" tasks as the task queue
+    void reserve(int capacity) {
+        ring_tq.reset(static_cast<size_t>(capacity));
+    }
+
+    // release the storage the empty queues kept, called by the thread itself
+    void shrinkStorage() {
+        util::spinlock_guard lock(tq_locker);
+        for (auto q : {&tq, &high_tq, &low_tq}) {
+            if (q->empty()) {
+                std::queue<HipeTask>().swap(*q);
+            }
+        }
+    }
+
     /**
      * @brief try give one task to another thread
      * @param other another thread
@@ -17,49 +56,142 @@ public:
      */
     bool tryGiveTask(OqThread& another) {
         if (tq_locker.try_lock()) {
+            if (prior_numb.load() && !high_tq.empty()) {
+                giveLaneTask(high_tq, another);
+                tq_locker.unlock();
+                return true;
+            }
+            if (ring_tq.capacity()) {
+                bool ok = ring_tq.pop(another.task);
+                tq_locker.unlock();
+                if (ok) {
+                    another.takeOver(*this);
+                }
+                return ok || giveLocalTask(another) || tryGiveLowTask(another);
+            }
             if (!tq.empty()) {
                 another.task = std::move(tq.front());
                 tq.pop();
                 tq_locker.unlock();
-                this->task_numb--;
-                another.task_numb++;
+                another.takeOver(*this);
                 return true;
 
             } else {
                 tq_locker.unlock();
-                return false;
+                return giveLocalTask(another) || tryGiveLowTask(another);
             }
         }
         return false;
     }
 
+    // give one low priority task to another thread
+    bool tryGiveLowTask(OqThread& another) {
+        if (!prior_numb.load()) {
+            return false;
+        }
+        util::spinlock_guard lock(tq_locker);
+        if (low_tq.empty()) {
+            return false;
+        }
+        giveLaneTask(low_tq, another);
+        return true;
+    }
+
+    // give one task submitted by the thread itself to another thread
+    bool giveLocalTask(OqThread& another) {
+        if (local_tq.steal(another.task)) {
+            another.takeOver(*this);
+            return true;
+        }
+        return false;
+    }
+
     // push task to the task queue
     template <typename T>
     void enqueue(T&& tar) {
-        util::spinlock_guard lock(tq_locker);
-        tq.emplace(std::forward<T>(tar));
         task_numb++;
+        push(std::forward<T>(tar));
     }
 
-    // push tasks to the task queue
+    // push the tasks in [begin, end) of the container
     template <typename Container_>
-    void enqueue(Container_& cont, size_t size) {
-        util::spinlock_guard lock(tq_locker);
-        for (size_t i = 0; i < size; ++i) {
-            tq.emplace(std::move(cont[i]));
-            task_numb++;
+    void enqueue(Container_& cont, size_t begin, size_t end) {
+        task_numb += static_cast<int>(end - begin);
+        pushBatch(cont, begin, end);
+    }
+
+    // push the tasks in [begin, end) of the container that have been counted by reserveUpTo(), with one lock
+    template <typename Container_>
+    void pushBatch(Container_& cont, size_t begin, size_t end) {
+        if (ring_tq.capacity()) {
+            for (size_t i = begin; i < end; ++i) {
+                ring_tq.push(std::move(cont[i]));
+            }
+        } else {
+            util::spinlock_guard lock(tq_locker);
+            for (size_t i = begin; i < end; ++i) {
+                tq.emplace(std::move(cont[i]));
+            }
         }
+        wake();
+    }
+
+    // push a task with priority to the lanes
+    template <typename T>
+    void enqueue(T&& tar, TaskPriority priority) {
+        task_numb++;
+        push(std::forward<T>(tar), priority);
+    }
+
+    // push a task with priority that has been counted by tryReserve()
+    template <typename T>
+    void push(T&& tar, TaskPriority priority) {
+        if (priority == TaskPriority::normal) {
+            push(std::forward<T>(tar));
+            return;
+        }
+        {
+            util::spinlock_guard lock(tq_locker);
+            (priority == TaskPriority::high ? high_tq : low_tq).emplace(std::forward<T>(tar));
+            prior_numb++;
+        }
+        wake();
+    }
+
+    // whether there are tasks in the high or low lanes
+    bool hasPriorTasks() const {
+        return prior_numb.load(std::memory_order_relaxed) != 0;
+    }
+
+    // push a task that has been counted by tryReserve()
+    template <typename T>
+    void push(T&& tar) {
+        if (ring_tq.capacity()) {
+            ring_tq.push(std::forward<T>(tar));
+        } else {
+            util::spinlock_guard lock(tq_locker);
+            tq.emplace(std::forward<T>(tar));
+        }
+        wake();
     }
 
     // run the task
     void runTask() {
-        util::invoke(task);
-        task_numb--;
+        invokeTask(task);
+        taskDone();
     }
 
     // try load task from the task queue
     bool tryLoadTask() {
+        if (!local_tq.empty() && local_tq.pop(task)) {
+            return true;
+        }
         tq_locker.lock();
+        if (ring_tq.capacity()) {
+            bool ok = ring_tq.pop(task);
+            tq_locker.unlock();
+            return ok;
+        }
         if (!tq.empty()) {
             task = std::move(tq.front());
             tq.pop();
@@ -70,6 +202,179 @@ public:
             return false;
         }
     }
+
+    /**
+     * Try load task from the lanes in order of priority, the normal tasks are in the local deque and the task queue.
+     * A lower lane that has been passed over for "aging_limit" rounds goes first once, so that it never starves.
+     */
+    bool tryLoadPriorTask() {
+        util::spinlock_guard lock(tq_locker);
+        bool has[3] = {!high_tq.empty(), !local_tq.empty() || (ring_tq.capacity() ? ring_tq.size() > 0 : !tq.empty()),
+                       !low_tq.empty()};
+
+        int pick = -1;
+        for (int i = 2; i > 0; --i) {
+            if (has[i] && aging[i] >= aging_limit) {
+                pick = i;
+                break;
+            }
+        }
+        for (int i = 0; pick < 0 && i < 3; ++i) {
+            if (has[i]) {
+                pick = i;
+            }
+        }
+        if (pick < 0) {
+            return false;
+        }
+        aging[pick] = 0;
+        for (int i = pick + 1; i < 3; ++i) {
+            aging[i] += has[i];
+        }
+
+        if (pick == 1) {
+            if (!local_tq.empty() && local_tq.pop(task)) {
+                return true;
+            }
+            if (ring_tq.capacity()) {
+                return ring_tq.pop(task);
+            }
+            if (tq.empty()) {
+                return false;
+            }
+            task = std::move(tq.front());
+            tq.pop();
+            return true;
+        }
+        auto& lane = (pick == 0) ? high_tq : low_tq;
+        task = std::move(lane.front());
+        lane.pop();
+        prior_numb--;
+        return true;
+    }
+
+    // run one task that has not been loaded in order of priority, for the thread waiting in a task (as "task" is running)
+    bool runUnloadedTask() {
+        HipeTask tmp;
+        {
+            util::spinlock_guard lock(tq_locker);
+            if (prior_numb.load() && !high_tq.empty()) {
+                popLane(high_tq, tmp);
+            } else if (!popNormal(tmp)) {
+                if (!prior_numb.load() || low_tq.empty()) {
+                    return false;
+                }
+                popLane(low_tq, tmp);
+            }
+        }
+        invokeTask(tmp);
+        taskDone();
+        return true;
+    }
+
+    // take tasks from another thread and run one, for the thread waiting in a task
+    bool helpFrom(OqThread& another) {
+        return another.tryGiveHalfTasks(*this) && (runLocalTask() || runUnloadedTask());
+    }
+
+    // (work-stealing mode) try load task from the local deque, refill the deque if it is empty
+    bool tryLoadLocalTask() {
+        if (!local_tq.empty() && local_tq.pop(task)) {
+            return true;
+        }
+        {
+            util::spinlock_guard lock(tq_locker);
+            if (ring_tq.capacity()) {
+                pullToLocal(ring_tq, localSpare(), *this);
+            } else {
+                pullToLocal(tq, localSpare(), *this);
+            }
+        }
+        return local_tq.pop(task);
+    }
+
+    /**
+     * (work-stealing mode) give about half of the tasks to another thread.
+     * Tasks in the local deque are preferred, then the tasks in the task queue.
+     * The tasks of the high and low lanes go to the same lanes of the thief, so they keep their priority.
+     */
+    bool tryGiveHalfTasks(OqThread& another) {
+        if (prior_numb.load() && tq_locker.try_lock()) {
+            int numb = giveHalfLane(high_tq, another);
+            tq_locker.unlock();
+            if (numb > 0) {
+                return true;
+            }
+        }
+        if (another.stealLocalTasks(*this)) {
+            return true;
+        }
+        if (tq_locker.try_lock()) {
+            int numb = 0;
+            if (ring_tq.capacity()) {
+                numb = another.pullToLocal(ring_tq, static_cast<int>((ring_tq.size() + 1) / 2), *this);
+            } else {
+                numb = another.pullToLocal(tq, static_cast<int>((tq.size() + 1) / 2), *this);
+            }
+            if (!numb && prior_numb.load()) {
+                numb = giveHalfLane(low_tq, another);
+            }
+            tq_locker.unlock();
+            return numb > 0;
+        }
+        return false;
+    }
+
+private:
+    // pop the first task of the task queue, "tq_locker" should be held
+    bool popNormal(HipeTask& out) {
+        if (ring_tq.capacity()) {
+            return ring_tq.pop(out);
+        }
+        if (tq.empty()) {
+            return false;
+        }
+        out = std::move(tq.front());
+        tq.pop();
+        return true;
+    }
+
+    // pop the first task of a lane, "tq_locker" should be held
+    void popLane(std::queue<HipeTask>& lane, HipeTask& out) {
+        out = std::move(lane.front());
+        lane.pop();
+        prior_numb--;
+    }
+
+    /**
+     * Move about half of a lane to the same lane of another thread, "tq_locker" should be held.
+     * The lock of the thief is only tried, so two threads stealing from each other never deadlock.
+     * @return the number of tasks moved
+     */
+    int giveHalfLane(std::queue<HipeTask>& lane, OqThread& another) {
+        if (lane.empty() || !another.tq_locker.try_lock()) {
+            return 0;
+        }
+        auto& dest = (&lane == &high_tq) ? another.high_tq : another.low_tq;
+        int numb = static_cast<int>((lane.size() + 1) / 2);
+        for (int i = 0; i < numb; ++i) {
+            dest.emplace(std::move(lane.front()));
+            lane.pop();
+        }
+        prior_numb -= numb;
+        another.prior_numb += numb;
+        another.takeOver(*this, numb);
+        another.tq_locker.unlock();
+        return numb;
+    }
+
+    // give the first task of a lane to another thread, "tq_locker" should be held
+    void giveLaneTask(std::queue<HipeTask>& lane, OqThread& another) {
+        another.task = std::move(lane.front());
+        lane.pop();
+        prior_numb--;
+        another.takeOver(*this);
+    }
 };
 
 
@@ -78,37 +383,124 @@ class BalancedThreadPond : public FixedThreadPond<OqThread>
 public:
     /**
      * @param thread_numb fixed thread number
-     * @param task_capacity task capacity of the pond, default: unlimited
+     * @param task_capacity task capacity of the pond, default: unlimited.
+     * If the capacity is limited, each thread will preallocate a lock-free ring buffer as its task queue.
+     * @param placement pin the workers by an AffinityPolicy or a cpu list, default: not pinned.
+     * The pinned workers allocate their queues on their own numa nodes.
      */
-    explicit BalancedThreadPond(int thread_numb = 0, int task_capacity = HipeUnlimited)
-      : FixedThreadPond(thread_numb, task_capacity) {
+    explicit BalancedThreadPond(int thread_numb = 0, int task_capacity = HipeUnlimited, const Placement& placement = Placement())
+      : FixedThreadPond(thread_numb, task_capacity, placement) {
         // create
         threads.reset(new OqThread[this->thread_numb]);
 
+        // the queues must be ready before any thread starts, as the workers may visit each other
+        // (the pinned workers allocate their own queues)
+        for (int i = 0; thread_cap && worker_cpu.empty() && i < this->thread_numb; ++i) {
+            threads[i].reserve(thread_cap);
+        }
         for (int i = 0; i < this->thread_numb; ++i) {
             threads[i].bindHandle(AutoThread(&BalancedThreadPond::worker, this, i));
         }
+        waitForPlacement();
     }
     ~BalancedThreadPond() override = default;
 
+    using FixedThreadPond::submit;
+    using FixedThreadPond::submitForReturn;
+
+    /**
+     * @brief submit task with priority
+     * The threads run the high priority tasks first, and the stealing threads also prefer them.
+     * The lower priority tasks that have waited for a long time still get their turn.
+     * @param foo a runnable object
+     * @param priority priority of the task
+     */
+    template <typename F>
+    void submit(F&& foo, TaskPriority priority) {
+        if (!postPrior(std::forward<F>(foo), priority)) {
+            taskOverFlow(std::forward<F>(foo));
+        }
+    }
+
+    // try to submit task with priority without overflowing, the task is not moved if the pond is full
+    template <typename F>
+    bool trySubmit(F&& foo, TaskPriority priority) {
+        return postPrior(std::forward<F>(foo), priority);
+    }
+
+    using FixedThreadPond::trySubmit;
+
+    /**
+     * @brief submit task with priority and get return
+     * @param foo a runnable object
+     * @param priority priority of the task
+     * @return a future
+     */
+    template <typename F>
+    auto submitForReturn(F&& foo, TaskPriority priority) -> Future<typename std::result_of<F()>::type> {
+        using RT = typename std::result_of<F()>::type;
+        Future<RT> fut;
+        auto task = util::packTask(std::forward<F>(foo), fut);
+
+        if (!postPrior(std::move(task), priority)) {
+            taskOverFlow(std::move(task));
+            return Future<RT>();
+        }
+        return fut;
+    }
+
 private:
+    // deliver a task with priority, the normal ones take the usual way
+    template <typename T>
+    bool postPrior(T&& task, TaskPriority priority) {
+        if (priority == TaskPriority::normal) {
+            return post(std::forward<T>(task));
+        }
+        if (!admitTask(taskBytes(task))) {
+            return false;
+        }
+        if (thread_cap) {
+            getThreadNow()->push(std::forward<T>(task), priority);
+        } else {
+            getLeastBusyThread()->enqueue(std::forward<T>(task), priority);
+        }
+        return true;
+    }
+
     void worker(int index) {
         auto& self = threads[index];
+        enterWorker(self, index);
+        int idle_rounds = 0;
 
         while (!stop) {
             // yield if no tasks
             if (self.notask()) {
+                HIPE_METRICS(self.metrics.toIdle());
                 if (self.isWaiting()) {
                     self.notifyTaskDone();
                     std::this_thread::yield();
                     continue;
                 }
+                // take over the tasks of a blocked worker, even if the stealing is disabled
+                if (takeBlockedTasks(self)) {
+                    continue;
+                }
 
                 // steal tasks from other threads
-                if (enable_steal_tasks) {
+                if (enable_steal_tasks && work_stealing) {
+                    for (int j = 0; j < max_steal; j++) {
+                        if (threads[getRandomVictim(self, j)].tryGiveHalfTasks(self)) {
+                            break;
+                        }
+                    }
+                    if (!self.notask() || self.isWaiting()) {
+                        continue;
+                    }
+                } else if (enable_steal_tasks) {
                     for (int i = index, j = 0; j < max_steal; j++) {
                         util::recyclePlus(i, 0, thread_numb);
                         if (threads[i].tryGiveTask(self)) {
+                            HIPE_METRICS(self.metrics.toBusy());
                             self.runTask();
                             break;
                         }
@@ -118,11 +510,17 @@ private:
                         continue;
                     }
                 }
-                std::this_thread::yield();
+                idleWait(self, idle_rounds);
 
             } else {
-                // try load task and run
-                if (self.tryLoadTask()) {
+                idle_rounds = 0;
+                HIPE_METRICS(self.metrics.toBusy(); self.metrics.observeDepth(self.getTasksNumb()));
+                HIPE_TRACE(self.trace.record(util::TraceKind::load, self.getTasksNumb()));
+                if (self.getTasksNumb() > 1) {
+                    wakeThief(self);
+                }
+                // try load task and run, the lanes of priority are checked only if they have tasks
+                if (self.hasPriorTasks() ? self.tryLoadPriorTask() : (work_stealing ? self.tryLoadLocalTask() : self.tryLoadTask())) {
                     self.runTask();
                 }
             }
@@ -0,0 +1,495 @@
+#include "../hipe.h"
+#include "./BS_thread_pool.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+// =========================================================================================================
+//    one driver for all the scenarios, sweeping the ponds and the thread numbers, output table/csv/json
+//
+//    ./bench --scenarios empty,latency --ponds steady,bs --threads 1,4,8 --repeat 5 --format json --output a.json
+// =========================================================================================================
+
+struct Options {
+    std::vector<std::string> scenarios = {"empty", "speedup", "multi_producer", "batch", "latency", "steal", "idle"};
+    std::vector<std::string> ponds = {"steady", "balance", "dynamic", "bs"};
+    std::vector<int> threads;
+    int repeat = 5;
+    int tasks = 200000;
+    int producers = 4;
+    int batch = 1000;
+    std::string format = "table";
+    std::string output;
+};
+
+Options opt;
+
+// ======================
+//        result
+// ======================
+
+struct Stats {
+    double mean = 0, stddev = 0, min = 0, max = 0;
+};
+
+Stats statsOf(std::vector<double> v) {
+    Stats s;
+    if (v.empty()) {
+        return s;
+    }
+    std::sort(v.begin(), v.end());
+    s.min = v.front();
+    s.max = v.back();
+    for (auto x : v) {
+        s.mean += x;
+    }
+    s.mean /= v.size();
+    for (auto x : v) {
+        s.stddev += (x - s.mean) * (x - s.mean);
+    }
+    s.stddev = v.size() > 1 ? std::sqrt(s.stddev / (v.size() - 1)) : 0.0;
+    return s;
+}
+
+struct Row {
+    std::string scenario;
+    std::string pond;
+    int threads;
+    std::string metric;
+    std::string unit;
+    Stats stats;
+};
+
+std::vector<Row> rows;
+
+// one run of a scenario gives some named values, the runs are repeated and each value is summarized
+using Sample = std::map<std::string, double>;
+
+// ======================
+//        ponds
+// ======================
+
+// uniform interface of the ponds
+template <typename Pond>
+struct Adapter {
+    // task type of the batches
+    using BatchTask = hipe::HipeTask;
+
+    Pond pond;
+    explicit Adapter(int n)
+      : pond(n) {
+    }
+    template <typename F>
+    void submit(F&& f) {
+        pond.submit(std::forward<F>(f));
+    }
+    void submitBatch(std::vector<BatchTask>& tasks) {
+        pond.submitInBatch(tasks, tasks.size());
+    }
+    void wait() {
+        pond.waitForTasks();
+    }
+    // (steal scenario) turn on the stealing if the pond supports it
+    bool enableSteal(int n) {
+        return enableSteal(pond, n, 0);
+    }
+
+private:
+    template <typename P>
+    static auto enableSteal(P& p, int n, int) -> decltype(p.enableStealTasks(n), bool()) {
+        p.enableStealTasks(n);
+        return true;
+    }
+    template <typename P>
+    static bool enableSteal(P&, int, long) {
+        return false;
+    }
+};
+
+template <>
+struct Adapter<BS::thread_pool> {
+    // BS only takes copyable tasks
+    using BatchTask = std::function<void()>;
+
+    BS::thread_pool pond;
+    explicit Adapter(int n)
+      : pond(static_cast<BS::concurrency_t>(n)) {
+    }
+    template <typename F>
+    void submit(F&& f) {
+        pond.push_task(std::forward<F>(f));
+    }
+    // no batch interface, push one by one
+    void submitBatch(std::vector<BatchTask>& tasks) {
+        for (auto& t : tasks) {
+            pond.push_task(std::move(t));
+        }
+    }
+    void wait() {
+        pond.wait_for_tasks();
+    }
+    bool enableSteal(int) {
+        return false;
+    }
+};
+
+// ======================
+//       workloads
+// ======================
+
+void compute(int rounds) {
+    volatile double x = 0;
+    for (int k = 0; k < rounds; ++k) {
+        x = x + k * 0.5;
+    }
+}
+
+int64_t nowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+double serialTime(int numb, int rounds) {
+    return hipe::util::timewait([&] {
+        for (int i = 0; i < numb; ++i) {
+            compute(rounds);
+        }
+    });
+}
+
+// ======================
+//       scenarios
+// ======================
+
+// empty tasks from one producer
+template <typename Pond>
+Sample runEmpty(Pond& p, int) {
+    double t = hipe::util::timewait([&] {
+        for (int i = 0; i < opt.tasks; ++i) {
+            p.submit([] {});
+        }
+        p.wait();
+    });
+    return {{"throughput", opt.tasks / t}};
+}
+
+// compute tasks against one thread running them in turn
+template <typename Pond>
+Sample runSpeedup(Pond& p, int) {
+    int numb = std::max(1, opt.tasks / 100);
+    int rounds = 20000;
+    double serial = serialTime(numb, rounds);
+    double t = hipe::util::timewait([&] {
+        for (int i = 0; i < numb; ++i) {
+            p.submit([rounds] { compute(rounds); });
+        }
+        p.wait();
+    });
+    return {{"speedup", serial / t}};
+}
+
+// many threads submitting at the same time
+template <typename Pond>
+Sample runMultiProducer(Pond& p, int) {
+    int each = opt.tasks / opt.producers;
+    double t = hipe::util::timewait([&] {
+        std::vector<std::thread> producers;
+        for (int k = 0; k < opt.producers; ++k) {
+            producers.emplace_back([&] {
+                for (int i = 0; i < each; ++i) {
+                    p.submit([] {});
+                }
+            });
+        }
+        for (auto& th : producers) {
+            th.join();
+        }
+        p.wait();
+    });
+    return {{"throughput", each * opt.producers / t}};
+}
+
+// empty tasks submitted in batches
+template <typename Pond>
+Sample runBatch(Pond& p, int) {
+    int rounds = std::max(1, opt.tasks / opt.batch);
+    std::vector<typename Pond::BatchTask> tasks;
+    double t = hipe::util::timewait([&] {
+        for (int r = 0; r < rounds; ++r) {
+            tasks.clear();
+            for (int i = 0; i < opt.batch; ++i) {
+                tasks.emplace_back([] {});
+            }
+            p.submitBatch(tasks);
+        }
+        p.wait();
+    });
+    return {{"throughput", static_cast<double>(rounds) * opt.batch / t}};
+}
+
+// time from submitting a task to its start, the tasks are submitted one by one with small gaps
+template <typename Pond>
+Sample runLatency(Pond& p, int) {
+    int numb = std::max(100, std::min(opt.tasks / 20, 20000));
+    std::vector<int64_t> lat(numb);
+    for (int i = 0; i < numb; ++i) {
+        int64_t start = nowNanos();
+        p.submit([&lat, i, start] { lat[i] = nowNanos() - start; });
+        // leave the pond idle for a while, so that the wake-up cost is counted as well
+        if (i % 16 == 15) {
+            p.wait();
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+    p.wait();
+    std::sort(lat.begin(), lat.end());
+    auto pick = [&](double q) { return lat[std::min(numb - 1, static_cast<int>(q * numb))] / 1e3; };
+    return {{"latency_p50", pick(0.5)}, {"latency_p99", pick(0.99)}, {"latency_p999", pick(0.999)}};
+}
+
+// uneven tasks, the makespan against the ideal one (serial time / threads)
+template <typename Pond>
+Sample runSteal(Pond& p, int threads) {
+    int numb = std::max(threads, opt.tasks / 50);
+    auto rounds = [](int i) { return (i % 7 == 0) ? 20000 : 200; };
+    double serial = hipe::util::timewait([&] {
+        for (int i = 0; i < numb; ++i) {
+            compute(rounds(i));
+        }
+    });
+    // a single thread has nobody to steal from
+    if (threads > 1) {
+        p.enableSteal(std::max(1, threads / 2));
+    }
+    double t = hipe::util::timewait([&] {
+        for (int i = 0; i < numb; ++i) {
+            p.submit([i, &rounds] { compute(rounds(i)); });
+        }
+        p.wait();
+    });
+    int cpus = std::max(1, std::min(threads, static_cast<int>(std::thread::hardware_concurrency())));
+    return {{"efficiency", serial / cpus / t}};
+}
+
+// cpu time used by an idle pond
+template <typename Pond>
+Sample runIdle(Pond& p, int) {
+    p.submit([] {});
+    p.wait();
+    std::clock_t c0 = std::clock();
+    double wall = hipe::util::timewait([] { std::this_thread::sleep_for(std::chrono::milliseconds(200)); });
+    double cpu = static_cast<double>(std::clock() - c0) / CLOCKS_PER_SEC;
+    return {{"idle_cpu", 100.0 * cpu / wall}};
+}
+
+const std::map<std::string, std::string> units = {
+    {"throughput", "tasks/s"},  {"speedup", "x"},       {"latency_p50", "us"}, {"latency_p99", "us"},
+    {"latency_p999", "us"},     {"efficiency", "ratio"}, {"idle_cpu", "%"},
+};
+
+template <typename PondT>
+void runScenario(const std::string& scenario, const std::string& pond_name, int threads) {
+    std::map<std::string, std::vector<double>> values;
+    for (int r = 0; r < opt.repeat; ++r) {
+        // a new pond for each run, so that the runs don't affect each other
+        Adapter<PondT> p(threads);
+        Sample s;
+        if (scenario == "empty") {
+            s = runEmpty(p, threads);
+        } else if (scenario == "speedup") {
+            s = runSpeedup(p, threads);
+        } else if (scenario == "multi_producer") {
+            s = runMultiProducer(p, threads);
+        } else if (scenario == "batch") {
+            s = runBatch(p, threads);
+        } else if (scenario == "latency") {
+            s = runLatency(p, threads);
+        } else if (scenario == "steal") {
+            s = runSteal(p, threads);
+        } else if (scenario == "idle") {
+            s = runIdle(p, threads);
+        } else {
+            throw std::invalid_argument("unknown scenario: " + scenario);
+        }
+        for (auto& kv : s) {
+            values[kv.first].push_back(kv.second);
+        }
+    }
+    for (auto& kv : values) {
+        rows.push_back({scenario, pond_name, threads, kv.first, units.at(kv.first), statsOf(kv.second)});
+        auto& st = rows.back().stats;
+        fprintf(stderr, "%-14s | %-8s | threads: %-3d | %-12s: %14.2f ± %-10.2f %s\n", scenario.c_str(),
+                pond_name.c_str(), threads, kv.first.c_str(), st.mean, st.stddev, rows.back().unit.c_str());
+    }
+}
+
+void runPond(const std::string& scenario, const std::string& pond, int threads) {
+    if (pond == "steady") {
+        runScenario<hipe::SteadyThreadPond>(scenario, pond, threads);
+    } else if (pond == "balance") {
+        runScenario<hipe::BalancedThreadPond>(scenario, pond, threads);
+    } else if (pond == "dynamic") {
+        runScenario<hipe::DynamicThreadPond>(scenario, pond, threads);
+    } else if (pond == "bs") {
+        runScenario<BS::thread_pool>(scenario, pond, threads);
+    } else {
+        throw std::invalid_argument("unknown pond: " + pond);
+    }
+}
+
+// ======================
+//        output
+// ======================
+
+#ifdef __VERSION__
+const char* compiler = __VERSION__;
+#else
+const char* compiler = "unknown";
+#endif
+
+std::string today() {
+    std::time_t t = std::time(nullptr);
+    char buf[32];
+    std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", std::localtime(&t));
+    return buf;
+}
+
+void writeCsv(std::ostream& out) {
+    out << "scenario,pond,threads,metric,unit,mean,stddev,min,max,repeat\n";
+    for (auto& r : rows) {
+        out << r.scenario << ',' << r.pond << ',' << r.threads << ',' << r.metric << ',' << r.unit << ','
+            << r.stats.mean << ',' << r.stats.stddev << ',' << r.stats.min << ',' << r.stats.max << ',' << opt.repeat
+            << '\n';
+    }
+}
+
+void writeJson(std::ostream& out) {
+    out << "{\n  \"meta\": {\"date\": \"" << today() << "\", \"cpus\": " << std::thread::hardware_concurrency()
+        << ", \"compiler\": \"" << compiler << "\", \"repeat\": " << opt.repeat << ", \"tasks\": " << opt.tasks
+        << "},\n  \"results\": [\n";
+    for (size_t i = 0; i < rows.size(); ++i) {
+        auto& r = rows[i];
+        out << "    {\"scenario\": \"" << r.scenario << "\", \"pond\": \"" << r.pond << "\", \"threads\": " << r.threads
+            << ", \"metric\": \"" << r.metric << "\", \"unit\": \"" << r.unit << "\", \"mean\": " << r.stats.mean
+            << ", \"stddev\": " << r.stats.stddev << ", \"min\": " << r.stats.min << ", \"max\": " << r.stats.max
+            << "}" << (i + 1 < rows.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+void writeTable(std::ostream& out) {
+    char line[256];
+    for (auto& r : rows) {
+        snprintf(line, sizeof(line), "%-14s | %-8s | threads: %-3d | %-12s | mean: %14.2f | stddev: %10.2f | %s\n",
+                 r.scenario.c_str(), r.pond.c_str(), r.threads, r.metric.c_str(), r.stats.mean, r.stats.stddev,
+                 r.unit.c_str());
+        out << line;
+    }
+}
+
+// ======================
+//       arguments
+// ======================
+
+std::vector<std::string> splitList(const std::string& s) {
+    std::vector<std::string> ret;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            ret.push_back(item);
+        }
+    }
+    return ret;
+}
+
+void usage() {
+    printf("usage: bench [options]\n"
+           "  --scenarios LIST  empty,speedup,multi_producer,batch,latency,steal,idle (default: all)\n"
+           "  --ponds LIST      steady,balance,dynamic,bs (default: all)\n"
+           "  --threads LIST    thread numbers to sweep (default: 1,2,4... up to the cpu number)\n"
+           "  --repeat N        runs of each case (default: 5)\n"
+           "  --tasks N         tasks of each run (default: 200000)\n"
+           "  --producers N     producers of multi_producer (default: 4)\n"
+           "  --batch N         batch size of batch (default: 1000)\n"
+           "  --format F        table, csv or json (default: table)\n"
+           "  --output FILE     write the results to the file instead of stdout\n");
+}
+
+bool parseArgs(int argc, char** argv) {
+    for (int i = 1; i < argc; ++i) {
+        std::string key = argv[i];
+        if (key == "-h" || key == "--help") {
+            return false;
+        }
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing the value of %s\n", key.c_str());
+            return false;
+        }
+        std::string val = argv[++i];
+        if (key == "--scenarios") {
+            opt.scenarios = splitList(val);
+        } else if (key == "--ponds") {
+            opt.ponds = splitList(val);
+        } else if (key == "--threads") {
+            opt.threads.clear();
+            for (auto& t : splitList(val)) {
+                opt.threads.push_back(std::max(1, std::atoi(t.c_str())));
+            }
+        } else if (key == "--repeat") {
+            opt.repeat = std::max(1, std::atoi(val.c_str()));
+        } else if (key == "--tasks") {
+            opt.tasks = std::max(1, std::atoi(val.c_str()));
+        } else if (key == "--producers") {
+            opt.producers = std::max(1, std::atoi(val.c_str()));
+        } else if (key == "--batch") {
+            opt.batch = std::max(1, std::atoi(val.c_str()));
+        } else if (key == "--format") {
+            opt.format = val;
+        } else if (key == "--output") {
+            opt.output = val;
+        } else {
+            fprintf(stderr, "unknown option %s\n", key.c_str());
+            return false;
+        }
+    }
+    if (opt.threads.empty()) {
+        int cpus = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+        for (int t = 1; t < cpus; t *= 2) {
+            opt.threads.push_back(t);
+        }
+        opt.threads.push_back(cpus);
+    }
+    return opt.format == "table" || opt.format == "csv" || opt.format == "json";
+}
+
+int main(int argc, char** argv) {
+    if (!parseArgs(argc, argv)) {
+        usage();
+        return 1;
+    }
+    for (auto& scenario : opt.scenarios) {
+        for (auto threads : opt.threads) {
+            for (auto& pond : opt.ponds) {
+                runPond(scenario, pond, threads);
+            }
+        }
+    }
+
+    std::ofstream file;
+    if (!opt.output.empty()) {
+        file.open(opt.output);
+    }
+    std::ostream& out = opt.output.empty() ? std::cout : file;
+    if (opt.format == "csv") {
+        writeCsv(out);
+    } else if (opt.format == "json") {
+        writeJson(out);
+    } else {
+        writeTable(out);
+    }
+}
@@ -1,9 +1,29 @@
 #include "../hipe.h"
 #include "./BS_thread_pool.hpp"
+#include <cstdlib>
 
 int min_task_numb = 100;
 int max_task_numb = 1000000;
 
+// count the heap allocations to know how many of them are caused by the task wrapper
+std::atomic<size_t> alloc_count(0);
+
+void* operator new(size_t sz) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(sz ? sz : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
 // dynamic thread pond
 void test_Hipe_dynamic() {
     int tnumb = std::thread::hardware_concurrency();
@@ -86,8 +106,58 @@ void test_Hipe_balance() {
 }
 
 
+// submit empty tasks and tasks that capture a large buffer, then count the allocations per task
+template <typename Pond>
+void count_allocation(Pond& pond, const char* name) {
+    int task_numb = 100000;
+    struct Large {
+        char data[128];
+        void operator()() {
+        }
+    };
+
+    std::vector<hipe::Future<int>> futures(task_numb);
+
+    auto foo = [&](int kind) {
+        pond.waitForTasks();
+        size_t prev = alloc_count.load();
+        for (int i = 0; i < task_numb; ++i) {
+            if (kind == 0) {
+                pond.submit([] {});
+            } else if (kind == 1) {
+                pond.submit(Large());
+            } else {
+                futures[i] = pond.submitForReturn([] { return 0; });
+            }
+        }
+        pond.waitForTasks();
+        return static_cast<double>(alloc_count.load() - prev) / task_numb;
+    };
+    double small = foo(0);
+    double large = foo(1);
+    double ret = foo(2);
+    printf("pond: %-14s | task-size: %-3d(B) | small-task-allocs: %.3f | large-task-allocs: %.3f | return-task-allocs: %.3f\n", name,
+           static_cast<int>(sizeof(hipe::HipeTask)), small, large, ret);
+}
+
+void test_allocation() {
+    int tnumb = std::thread::hardware_concurrency();
+    hipe::util::print("\n", hipe::util::title("Heap allocations per submitted task"));
+
+    hipe::DynamicThreadPond pond1(tnumb);
+    hipe::SteadyThreadPond pond2(tnumb);
+    hipe::BalancedThreadPond pond3(tnumb);
+
+    count_allocation(pond1, "Hipe-Dynamic");
+    count_allocation(pond2, "Hipe-Steady");
+    count_allocation(pond3, "Hipe-Balance");
+}
+
+
 int main() {
 
+    test_allocation();
+
     test_BS();
 
     hipe::util::sleep_for_seconds(5);
@@ -0,0 +1,72 @@
+#include "../hipe.h"
+
+// =========================================================================================================
+//     Hipe-Hybrid against a Hipe-Steady that hands its refused tasks to a Hipe-Dynamic by the refuse callback
+// =========================================================================================================
+
+int thread_numb = 4;
+int task_capacity = 400;
+int burst_numb = 20;
+int burst_size = 5000;
+int batch_size = 500;
+
+// a task blocking for a while, such as waiting for io
+void blocking_task(std::atomic<int>* done) {
+    hipe::util::sleep_for_micro(50);
+    done->fetch_add(1, std::memory_order_relaxed);
+}
+
+template <typename Submit, typename Wait>
+double run_bursts(std::atomic<int>& done, Submit&& submit, Wait&& wait) {
+    return hipe::util::timewait<std::milli>([&] {
+        for (int b = 0; b < burst_numb; ++b) {
+            std::vector<hipe::HipeTask> tasks;
+            for (int i = 0; i < burst_size; ++i) {
+                tasks.emplace_back([&done] { blocking_task(&done); });
+                if (static_cast<int>(tasks.size()) == batch_size) {
+                    submit(tasks);
+                    tasks.clear();
+                }
+            }
+            wait();
+        }
+    });
+}
+
+void test_manual() {
+    std::atomic<int> done(0);
+    hipe::SteadyThreadPond steady(thread_numb, task_capacity);
+    hipe::DynamicThreadPond dynamic(0);
+    hipe::AutoScaleOptions options;
+    options.min_threads = 0;
+    dynamic.enableAutoScaling(options);
+
+    // get the refused tasks back and resubmit them
+    steady.setRefuseCallBack([&] {
+        auto refused = steady.pullOverFlowTasks();
+        dynamic.submitInBatch(refused, refused.element_numb());
+    });
+    double ms = run_bursts(
+        done, [&](std::vector<hipe::HipeTask>& tasks) { steady.submitInBatch(tasks, tasks.size()); },
+        [&] {
+            steady.waitForTasks();
+            dynamic.waitForTasks();
+        });
+    printf("pond: %-22s | tasks: %-7d | time: %8.2f ms\n", "Hipe-Steady + Dynamic", done.load(), ms);
+}
+
+void test_hybrid() {
+    std::atomic<int> done(0);
+    hipe::HybridThreadPond pond(thread_numb, task_capacity);
+    double ms = run_bursts(
+        done, [&](std::vector<hipe::HipeTask>& tasks) { pond.submitInBatch(tasks, tasks.size()); },
+        [&] { pond.waitForTasks(); });
+    printf("pond: %-22s | tasks: %-7d | time: %8.2f ms | spilled: %llu\n", "Hipe-Hybrid", done.load(), ms,
+           (unsigned long long)pond.getSpilledNumb());
+}
+
+int main() {
+    hipe::util::print(hipe::util::title("Test hybrid pond"));
+    test_manual();
+    test_hybrid();
+}
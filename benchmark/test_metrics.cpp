@@ -0,0 +1,68 @@
+#define HIPE_ENABLE_METRICS
+#include "../hipe.h"
+
+// =========================================================================================================
+//      the metrics of Hipe-Steady and Hipe-Balance under uneven tasks, with different stealing settings
+// =========================================================================================================
+
+int thread_numb = 8;
+int task_numb = 20000;
+int task_capacity = 40000;
+
+// one of every 7 tasks is much heavier than the others
+void uneven_task(int i) {
+    volatile double x = 0;
+    int rounds = (i % 7 == 0) ? 20000 : 200;
+    for (int k = 0; k < rounds; ++k) {
+        x = x + k * 0.5;
+    }
+}
+
+template <typename Pond>
+void report(const char* pond_name, const char* setting, Pond& pond) {
+    auto metrics = pond.getMetrics();
+    auto total = metrics.total();
+
+    uint64_t min_exec = total.executed, max_exec = 0;
+    for (auto& w : metrics.workers) {
+        min_exec = std::min(min_exec, w.executed);
+        max_exec = std::max(max_exec, w.executed);
+    }
+    auto busy = static_cast<double>(total.busy_ns);
+    auto idle = static_cast<double>(total.idle_ns);
+
+    printf("pond: %-12s | %-14s | executed min/max: %6llu/%-6llu | stolen: %-6llu | busy: %5.1f%% | high-water: %-6d | "
+           "wait p50/p99(us): %.1f/%.1f | run p99(us): %.1f | overflow: %llu\n",
+           pond_name, setting, (unsigned long long)min_exec, (unsigned long long)max_exec,
+           (unsigned long long)total.stolen, 100.0 * busy / (busy + idle), total.queue_high_water,
+           total.queue_wait.percentile(0.5) / 1e3, total.queue_wait.percentile(0.99) / 1e3,
+           total.run.percentile(0.99) / 1e3, (unsigned long long)metrics.overflow);
+}
+
+template <typename Pond>
+void test_setting(const char* pond_name, int setting) {
+    const char* names[] = {"no-stealing", "steal-tasks", "work-stealing"};
+
+    Pond pond(thread_numb, task_capacity);
+    if (setting == 1) {
+        pond.enableStealTasks(thread_numb / 2);
+    } else if (setting == 2) {
+        pond.enableWorkStealing(thread_numb / 2);
+    }
+    for (int i = 0; i < task_numb; ++i) {
+        pond.submit([i] { uneven_task(i); });
+    }
+    pond.waitForTasks();
+    report(pond_name, names[setting], pond);
+}
+
+int main() {
+    hipe::util::print(hipe::util::title("Test metrics"));
+
+    for (int setting = 0; setting < 3; ++setting) {
+        test_setting<hipe::SteadyThreadPond>("Hipe-Steady", setting);
+    }
+    for (int setting = 0; setting < 3; ++setting) {
+        test_setting<hipe::BalancedThreadPond>("Hipe-Balance", setting);
+    }
+}
@@ -0,0 +1,78 @@
+#include "../hipe.h"
+
+// =========================================================================================================
+//     submit throughput of Hipe-Steady, Hipe-Balance and Hipe-Dynamic when many threads submit at the same time
+// =========================================================================================================
+
+int thread_numb = 8;
+int max_producer_numb = 8;
+int task_numb = 1000000;
+
+/**
+ * @param producer_numb number of the threads submitting tasks into the same pond
+ * @return tasks submitted and done per second
+ */
+template <typename Pond>
+double test_producers(Pond& pond, int producer_numb) {
+    std::atomic_int done(0);
+    int each = task_numb / producer_numb;
+
+    double time_cost = hipe::util::timewait([&] {
+        std::vector<std::thread> producers;
+        for (int p = 0; p < producer_numb; ++p) {
+            producers.emplace_back([&] {
+                for (int i = 0; i < each; ++i) {
+                    pond.submit([&] { done++; });
+                }
+            });
+        }
+        for (auto& t : producers) {
+            t.join();
+        }
+        pond.waitForTasks();
+    });
+
+    if (done.load() != each * producer_numb) {
+        hipe::util::print("[Error]: lost tasks, expect ", each * producer_numb, " but got ", done.load());
+    }
+    return each * producer_numb / time_cost;
+}
+
+template <typename Pond>
+void test_pond(const char* name, int task_capacity) {
+    hipe::util::print("\n", hipe::util::title(name));
+    Pond pond(thread_numb, task_capacity);
+    if (task_capacity) {
+        // producers run the refused tasks by themselves
+        pond.setRefuseCallBack([&] {
+            auto blok = pond.pullOverFlowTasks();
+            for (size_t i = 0; i < blok.element_numb(); ++i) {
+                blok[i]();
+            }
+        });
+    }
+
+    for (int p = 1; p <= max_producer_numb; p *= 2) {
+        double throughput = test_producers(pond, p);
+        printf("threads: %-2d | capacity: %-6d | producers: %-2d | throughput: %.0f(tasks/s)\n", thread_numb,
+               task_capacity, p, throughput);
+    }
+}
+
+void test_dynamic_pond(const char* name) {
+    hipe::util::print("\n", hipe::util::title(name));
+    hipe::DynamicThreadPond pond(thread_numb);
+
+    for (int p = 1; p <= max_producer_numb; p *= 2) {
+        double throughput = test_producers(pond, p);
+        printf("threads: %-2d | producers: %-2d | throughput: %.0f(tasks/s)\n", thread_numb, p, throughput);
+    }
+}
+
+int main() {
+    test_pond<hipe::SteadyThreadPond>("Hipe-Steady multi producers", hipe::HipeUnlimited);
+    test_pond<hipe::SteadyThreadPond>("Hipe-Steady multi producers (bounded)", thread_numb * 1000);
+    test_pond<hipe::BalancedThreadPond>("Hipe-Balance multi producers", hipe::HipeUnlimited);
+    test_pond<hipe::BalancedThreadPond>("Hipe-Balance multi producers (bounded)", thread_numb * 1000);
+    test_dynamic_pond("Hipe-Dynamic multi producers");
+}
@@ -0,0 +1,54 @@
+#include "../hipe.h"
+#include <algorithm>
+
+// =========================================================================================================
+//        latency of interactive tasks sharing Hipe-Balance with a flood of batch jobs, with and without priority
+// =========================================================================================================
+
+int thread_numb = 4;
+int batch_numb = 20000;
+int request_numb = 200;
+
+// a batch job of about 20 microseconds
+void batch_job() {
+    auto t0 = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - t0 < std::chrono::microseconds(20)) {
+    }
+}
+
+void test_priority(bool use_priority) {
+    hipe::BalancedThreadPond pond(thread_numb);
+    std::vector<double> latency(request_numb);
+
+    // submit the batch jobs first, and then the interactive requests among them
+    for (int i = 0; i < batch_numb; ++i) {
+        if (use_priority) {
+            pond.submit(batch_job, hipe::TaskPriority::low);
+        } else {
+            pond.submit(batch_job);
+        }
+    }
+    for (int i = 0; i < request_numb; ++i) {
+        auto t0 = std::chrono::steady_clock::now();
+        auto request = [&latency, i, t0] {
+            latency[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        };
+        if (use_priority) {
+            pond.submit(request, hipe::TaskPriority::high);
+        } else {
+            pond.submit(request);
+        }
+        hipe::util::sleep_for_micro(200);
+    }
+    pond.waitForTasks();
+    std::sort(latency.begin(), latency.end());
+
+    printf("priority: %-3s | request-latency(ms) p50: %-9.3f p99: %-9.3f max: %-9.3f\n", use_priority ? "on" : "off",
+           latency[request_numb / 2], latency[request_numb * 99 / 100], latency.back());
+}
+
+int main() {
+    hipe::util::print(hipe::util::title("Test task priority of Hipe-Balance"));
+    test_priority(false);
+    test_priority(true);
+}
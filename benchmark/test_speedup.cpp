@@ -10,12 +10,17 @@ int vec_size = 4096;
 int vec_nums = 2048;
 std::vector<std::vector<double>> results(vec_nums, std::vector<double>(vec_size));
 
+// one row of the computation intensive task
+void compute_row(int i) {
+    for (int j = 0; j < vec_size; ++j) {
+        results[i][j] = std::log(std::sqrt(std::exp(std::sin(i) + std::cos(j))));
+    }
+}
+
 // computation intensive task
 void computation_intensive_task() {
     for (int i = 0; i < vec_nums; ++i) {
-        for (int j = 0; j < vec_size; ++j) {
-            results[i][j] = std::log(std::sqrt(std::exp(std::sin(i) + std::cos(j))));
-        }
+        compute_row(i);
     }
 }
 
@@ -179,6 +184,36 @@ void test_Hipe_balance() {
     }
 }
 
+/**
+ * split the rows of each task with hipe::parallel_for instead of submitting whole tasks
+ */
+void test_Hipe_parallel_for() {
+    int thread_numb = std::thread::hardware_concurrency();
+    int task_numb = thread_numb / 4;
+
+    hipe::util::print("\n", hipe::util::title("Test C++(11) Hipe parallel_for", 14), "\n");
+
+    hipe::SteadyThreadPond pond(thread_numb);
+
+    auto fooN = [&](int task_numb) {
+        for (int i = 0; i < task_numb; ++i) {
+            hipe::parallel_for(pond, 0, vec_nums, compute_row);
+        }
+    };
+
+    for (int i = 0; i < 6; ++i, task_numb += 12) {
+        double total = 0.0;
+        for (int j = 0; j < repeat_times; ++j) {
+            total += hipe::util::timewait<std::milli>(fooN, task_numb);
+        }
+        double time_cost = total / repeat_times;
+        double multi_per_task = time_cost / task_numb;
+
+        printf("threads: %-2d | task-type: %s | task-numb: %-2d | time-cost-per-task: %.5f(ms)\n", thread_numb,
+               "compute mode", task_numb, multi_per_task);
+    }
+}
+
 
 // Notice that don't do two tests at once
 int main() {
@@ -188,4 +223,5 @@ int main() {
     // test_Hipe_dynamic();
     test_Hipe_steady();
     // test_Hipe_balance();
+    // test_Hipe_parallel_for();
 }
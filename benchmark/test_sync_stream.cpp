@@ -0,0 +1,41 @@
+#include "../hipe.h"
+#include <fstream>
+
+// =========================================================================================================
+//      cost of printing from the workers, util::SyncStream in the sync mode and the async mode
+// =========================================================================================================
+
+int thread_numb = 4;
+int line_numb = 200000;
+
+// print from the tasks and return the time cost
+double test_stream(hipe::util::SyncStream& stream) {
+    hipe::SteadyThreadPond pond(thread_numb);
+    return hipe::util::timewait([&] {
+        for (int i = 0; i < line_numb; ++i) {
+            pond.submit([&stream, i] { stream.print("task ", i, " done, value: ", i * 0.5); });
+        }
+        pond.waitForTasks();
+        stream.flush();
+    });
+}
+
+int main() {
+    hipe::util::print(hipe::util::title("Test SyncStream"));
+    std::ofstream sink("/dev/null");
+
+    hipe::util::SyncStream sync_stream(sink);
+    printf("mode: %-14s | lines: %-7d | time-cost: %.5f(s)\n", "sync", line_numb, test_stream(sync_stream));
+
+    hipe::util::AsyncLogOptions options;
+    hipe::util::SyncStream block_stream(sink);
+    block_stream.enableAsync(options);
+    printf("mode: %-14s | lines: %-7d | time-cost: %.5f(s)\n", "async(block)", line_numb, test_stream(block_stream));
+
+    options.overflow = hipe::util::LogOverflow::drop;
+    hipe::util::SyncStream drop_stream(sink);
+    drop_stream.enableAsync(options);
+    double cost = test_stream(drop_stream);
+    printf("mode: %-14s | lines: %-7d | time-cost: %.5f(s) | dropped: %llu\n", "async(drop)", line_numb, cost,
+           (unsigned long long)drop_stream.getDropped());
+}
@@ -0,0 +1,62 @@
+#define HIPE_ENABLE_TRACE
+#include "../hipe.h"
+
+// =========================================================================================================
+//      the cost of tracing on Hipe-Steady and Hipe-Balance, and a timeline dumped to trace.json
+// =========================================================================================================
+
+using namespace hipe;
+
+int thread_numb = 4;
+int task_numb = 200000;
+
+void small_task() {
+    volatile int x = 0;
+    for (int k = 0; k < 100; ++k) {
+        x = x + k;
+    }
+}
+
+template <typename Pond>
+double run(Pond& pond) {
+    return util::timewait<std::milli>([&] {
+        for (int i = 0; i < task_numb; ++i) {
+            pond.submit(small_task);
+        }
+        pond.waitForTasks();
+    });
+}
+
+template <typename Pond>
+void test_overhead(const char* pond_name) {
+    Pond pond(thread_numb);
+    pond.enableWorkStealing(thread_numb / 2);
+
+    run(pond); // warm up
+    double off = run(pond);
+    pond.startTrace();
+    double on = run(pond);
+    pond.stopTrace();
+
+    printf("pond: %-12s | tracing off: %7.2f ms | tracing on: %7.2f ms | overhead: %5.1f%%\n", pond_name, off, on,
+           100.0 * (on - off) / off);
+}
+
+int main() {
+    util::print(util::title("Test trace"));
+
+    test_overhead<SteadyThreadPond>("Hipe-Steady");
+    test_overhead<BalancedThreadPond>("Hipe-Balance");
+
+    // uneven tasks make the stealing and the parking visible in the timeline
+    BalancedThreadPond pond(thread_numb);
+    pond.enableWorkStealing(thread_numb / 2);
+    pond.startTrace();
+    for (int i = 0; i < 2000; ++i) {
+        pond.submit([i] { util::sleep_for_micro(i % 50 == 0 ? 2000 : 20); });
+    }
+    pond.waitForTasks();
+    pond.stopTrace();
+    pond.dumpTrace("trace.json");
+    util::print("timeline written to trace.json, open it with chrome://tracing or https://ui.perfetto.dev");
+}
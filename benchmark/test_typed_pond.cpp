@@ -0,0 +1,64 @@
+#include "../hipe.h"
+
+// =========================================================================================================
+//     Hipe-Typed against Hipe-Steady when all the tasks are the same small functor
+// =========================================================================================================
+
+int thread_numb = 4;
+int task_numb = 2000000;
+int batch_size = 1000;
+
+// a small handler that every task runs
+struct Handler {
+    std::atomic<uint64_t>* sum;
+    uint64_t value;
+    void operator()() const {
+        sum->fetch_add(value, std::memory_order_relaxed);
+    }
+};
+
+template <typename Pond, typename Task>
+double test_submit(Pond& pond, std::atomic<uint64_t>& sum) {
+    return task_numb / hipe::util::timewait([&] {
+        for (int i = 0; i < task_numb; ++i) {
+            pond.submit(Task(Handler{&sum, 1}));
+        }
+        pond.waitForTasks();
+    });
+}
+
+template <typename Pond, typename Task>
+double test_batch(Pond& pond, std::atomic<uint64_t>& sum) {
+    std::vector<Task> tasks;
+    tasks.reserve(batch_size);
+    return task_numb / hipe::util::timewait([&] {
+        for (int i = 0; i < task_numb / batch_size; ++i) {
+            tasks.clear();
+            for (int k = 0; k < batch_size; ++k) {
+                tasks.emplace_back(Handler{&sum, 1});
+            }
+            pond.submitInBatch(tasks, tasks.size());
+        }
+        pond.waitForTasks();
+    });
+}
+
+template <typename Pond, typename Task>
+void test_pond(const char* name) {
+    std::atomic<uint64_t> sum(0);
+    Pond pond(thread_numb);
+    double single = test_submit<Pond, Task>(pond, sum);
+    double batch = test_batch<Pond, Task>(pond, sum);
+    uint64_t expect = static_cast<uint64_t>(task_numb) + static_cast<uint64_t>(task_numb / batch_size * batch_size);
+    if (sum.load() != expect) {
+        hipe::util::print("[Error]: lost tasks");
+    }
+    printf("pond: %-12s | threads: %-2d | submit: %12.0f(tasks/s) | batch submit: %12.0f(tasks/s)\n", name,
+           thread_numb, single, batch);
+}
+
+int main() {
+    hipe::util::print(hipe::util::title("Test typed pond"));
+    test_pond<hipe::SteadyThreadPond, hipe::HipeTask>("Hipe-Steady");
+    test_pond<hipe::TypedThreadPond<Handler>, Handler>("Hipe-Typed");
+}
@@ -0,0 +1,70 @@
+#include "../hipe.h"
+#include <algorithm>
+#include <ctime>
+
+// =========================================================================================================
+//         wake-up latency and idle cpu cost of the wait strategies of Hipe-Steady and Hipe-Balance
+// =========================================================================================================
+
+int thread_numb = 4;
+int sample_numb = 200;
+int idle_milli = 500;
+
+const char* strategy_name(hipe::WaitStrategy strategy) {
+    switch (strategy) {
+    case hipe::WaitStrategy::busy_spin:
+        return "busy-spin";
+    case hipe::WaitStrategy::spin_yield:
+        return "spin-yield";
+    default:
+        return "spin-park";
+    }
+}
+
+template <typename Pond>
+void test_strategy(const char* pond_name, hipe::WaitStrategy strategy) {
+    Pond pond(thread_numb);
+    pond.setWaitStrategy(strategy);
+
+    // let the threads fall idle and then submit one task, record the time it took to start running
+    std::vector<double> latency(sample_numb);
+    for (int i = 0; i < sample_numb; ++i) {
+        hipe::util::sleep_for_milli(2);
+        hipe::HipeTimePoint start_point;
+        auto t0 = std::chrono::steady_clock::now();
+        pond.submit([&] { start_point = std::chrono::steady_clock::now(); });
+        pond.waitForTasks();
+        latency[i] = std::chrono::duration<double, std::micro>(start_point - t0).count();
+    }
+    std::sort(latency.begin(), latency.end());
+
+    double mean = 0.0;
+    for (auto& l : latency) {
+        mean += l;
+    }
+    mean /= sample_numb;
+
+    // cpu time used by the process while the pond is idle
+    std::clock_t c0 = std::clock();
+    hipe::util::sleep_for_milli(idle_milli);
+    double cpu_milli = 1000.0 * static_cast<double>(std::clock() - c0) / CLOCKS_PER_SEC;
+
+    printf("pond: %-12s | strategy: %-10s | wake-up-latency(us) mean: %-9.2f p50: %-9.2f p99: %-9.2f | idle-cpu: "
+           "%.1f%%\n",
+           pond_name, strategy_name(strategy), mean, latency[sample_numb / 2], latency[sample_numb * 99 / 100],
+           100.0 * cpu_milli / idle_milli);
+}
+
+int main() {
+    hipe::util::print(hipe::util::title("Test wait strategies"));
+
+    hipe::WaitStrategy strategies[] = {hipe::WaitStrategy::busy_spin, hipe::WaitStrategy::spin_yield,
+                                       hipe::WaitStrategy::spin_park};
+
+    for (auto strategy : strategies) {
+        test_strategy<hipe::SteadyThreadPond>("Hipe-Steady", strategy);
+    }
+    for (auto strategy : strategies) {
+        test_strategy<hipe::BalancedThreadPond>("Hipe-Balance", strategy);
+    }
+}
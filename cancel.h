@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace hipe {
+
+/**
+ * @brief A token to cancel the tasks submitted with it.
+ * The copies share one state, so cancelling any of them cancels all the tasks holding the token. A cancelled task is
+ * skipped without running when a worker reaches it, and a running task can check CancellationToken::current() to exit
+ * early.
+ */
+class CancellationToken
+{
+    struct State {
+        std::atomic<bool> cancelled = {false};
+    };
+
+    std::shared_ptr<State> state;
+
+    static const CancellationToken*& currentRef() {
+        static thread_local const CancellationToken* token = nullptr;
+        return token;
+    }
+
+public:
+    CancellationToken()
+      : state(std::make_shared<State>()) {
+    }
+
+    void cancel() const {
+        state->cancelled.store(true, std::memory_order_release);
+    }
+
+    bool isCancelled() const {
+        return state->cancelled.load(std::memory_order_acquire);
+    }
+
+    // token of the task running on the calling thread, nullptr if the task has no token
+    static const CancellationToken* current() {
+        return currentRef();
+    }
+
+    // make the token visible as current() while a task is running
+    class Scope
+    {
+        const CancellationToken* prev;
+
+    public:
+        explicit Scope(const CancellationToken& token)
+          : prev(currentRef()) {
+            currentRef() = &token;
+        }
+        ~Scope() {
+            currentRef() = prev;
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+};
+
+
+namespace util {
+
+// a task that is skipped if its token has been cancelled
+template <typename F>
+class CancellableTask
+{
+    F foo;
+    CancellationToken token;
+
+public:
+    template <typename T>
+    CancellableTask(T&& tar, CancellationToken tk)
+      : foo(std::forward<T>(tar))
+      , token(std::move(tk)) {
+    }
+
+    void operator()() {
+        if (token.isCancelled()) {
+            return;
+        }
+        CancellationToken::Scope scope(token);
+        foo();
+    }
+};
+
+} // namespace util
+
+
+/**
+ * @brief attach a token to a task, the result can be submitted to any pond or in a batch
+ */
+template <typename F>
+util::CancellableTask<typename std::decay<F>::type> withToken(const CancellationToken& token, F&& foo) {
+    return util::CancellableTask<typename std::decay<F>::type>(std::forward<F>(foo), token);
+}
+
+} // namespace hipe
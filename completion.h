@@ -0,0 +1,307 @@
+#pragma once
+#include "./util.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <future>
+#include <limits>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hipe {
+
+/**
+ * @brief A queue of the results of tasks in the order they finish.
+ * The tasks are submitted to any pond through the queue, and each one moves its result into the queue once it is done,
+ * so the consumer can take the finished results one by one or in batches while the slow tasks are still running.
+ * The exception thrown by a task is rethrown when its slot is popped, and a task dropped without running (such as a
+ * task cancelled by closing the pond) leaves a std::future_error of broken_promise. The queue waits for its tasks while being destroyed.
+ * A worker of the fixed ponds waiting for a result runs the other tasks of its pond meanwhile.
+ * @tparam T type of the results, which only needs to be movable
+ */
+template <typename T>
+class CompletionQueue
+{
+    static_assert(!std::is_void<T>::value, "[HipeError]: CompletionQueue needs results, use TaskGroup for void tasks");
+
+    // a result or the exception of a task
+    class Item
+    {
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type buf;
+        bool has_value = false;
+        std::exception_ptr error = nullptr;
+
+    public:
+        explicit Item(T&& val) {
+            ::new (&buf) T(std::move(val));
+            has_value = true;
+        }
+
+        explicit Item(std::exception_ptr e)
+          : error(std::move(e)) {
+        }
+
+        Item(Item&& other) noexcept(std::is_nothrow_move_constructible<T>::value)
+          : error(std::move(other.error)) {
+            if (other.has_value) {
+                ::new (&buf) T(std::move(other.value()));
+                has_value = true;
+            }
+        }
+
+        Item(const Item&) = delete;
+        Item& operator=(const Item&) = delete;
+
+        ~Item() {
+            if (has_value) {
+                value().~T();
+            }
+        }
+
+        bool failed() const {
+            return !has_value;
+        }
+
+        // move the result out, or rethrow the exception
+        T take() {
+            if (!has_value) {
+                std::rethrow_exception(error);
+            }
+            return std::move(value());
+        }
+
+    private:
+        T& value() {
+            return *reinterpret_cast<T*>(&buf);
+        }
+    };
+
+    std::mutex locker;
+    std::condition_variable ready_cv;
+    std::deque<Item> items;
+
+    // threads sleeping on "ready_cv", protected by "locker"
+    int sleepers = 0;
+
+    // tasks not finished, and results in the queue
+    std::atomic_int pending = {0};
+    std::atomic_int ready_numb = {0};
+
+    // a task of the queue, which leaves a broken promise if it is destroyed without running
+    template <typename F>
+    class Member
+    {
+        F foo;
+        CompletionQueue* queue;
+
+    public:
+        template <typename U>
+        Member(U&& tar, CompletionQueue* owner)
+          : foo(std::forward<U>(tar))
+          , queue(owner) {
+        }
+
+        Member(Member&& other) noexcept
+          : foo(std::move(other.foo))
+          , queue(other.queue) {
+            other.queue = nullptr;
+        }
+
+        Member(const Member&) = delete;
+        Member& operator=(const Member&) = delete;
+
+        ~Member() {
+            if (queue) {
+                queue->put(Item(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise))));
+            }
+        }
+
+        // take the task out of the queue, it leaves no result then
+        void detach() {
+            queue = nullptr;
+        }
+
+        void operator()() {
+            CompletionQueue* owner = queue;
+            queue = nullptr;
+            try {
+                owner->put(Item(foo()));
+            } catch (...) {
+                owner->put(Item(std::current_exception()));
+            }
+        }
+    };
+
+public:
+    CompletionQueue() = default;
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    ~CompletionQueue() {
+        // a worker runs the other tasks first, taking the locker then waits for the last task to leave it
+        util::WorkerHelper::current().helpUntil([this] { return !pending.load(); });
+        std::unique_lock<std::mutex> lock(locker);
+        sleepers++;
+        ready_cv.wait(lock, [this] { return !pending.load(); });
+        sleepers--;
+    }
+
+    /**
+     * @brief submit a task whose result goes to the queue
+     * @param pond any pond of hipe
+     * @param foo a runnable object returning T
+     * @param args other arguments of the pond's submit(), such as the priority of BalancedThreadPond
+     * @throw std::runtime_error if the pond is full, the task leaves no result then and the refuse callback is not called
+     */
+    template <typename Pond, typename F, typename... Args>
+    void submit(Pond& pond, F&& foo, Args&&... args) {
+        pending++;
+        auto task = wrap(std::forward<F>(foo));
+        if (!util::trySubmitCounted(pond, task, 0, std::forward<Args>(args)...)) {
+            // the queue never waits for a task kept by the pond
+            task.detach();
+            cancel();
+            throw std::runtime_error("[HipeError]: Task overflow while submitting task to the completion queue");
+        }
+    }
+
+    /**
+     * @brief count a task into the queue and return the wrapped one, which can be submitted in a batch
+     * The wrapped task must be run or destroyed, otherwise the queue will wait for it forever.
+     */
+    template <typename F>
+    Member<typename std::decay<F>::type> add(F&& foo) {
+        pending++;
+        return wrap(std::forward<F>(foo));
+    }
+
+    /**
+     * @brief wait for the next finished result and move it out
+     * If the task threw, the exception is rethrown and the slot is consumed.
+     * @return false if there is no result left and no task pending
+     */
+    bool pop(T& out) {
+        std::unique_lock<std::mutex> lock(locker);
+        waitReady(lock);
+        if (items.empty()) {
+            return false;
+        }
+        out = takeFront();
+        return true;
+    }
+
+    // move out a finished result without waiting, return false if there is none
+    bool tryPop(T& out) {
+        if (!ready_numb.load()) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(locker);
+        if (items.empty()) {
+            return false;
+        }
+        out = takeFront();
+        return true;
+    }
+
+    // wait for a result for a while, return false if there is none after the timeout
+    template <typename Rep, typename Period>
+    bool popFor(T& out, const std::chrono::duration<Rep, Period>& timeout) {
+        std::unique_lock<std::mutex> lock(locker);
+        sleepers++;
+        ready_cv.wait_for(lock, timeout, [this] { return !items.empty() || !pending.load(); });
+        sleepers--;
+        if (items.empty()) {
+            return false;
+        }
+        out = takeFront();
+        return true;
+    }
+
+    /**
+     * @brief wait for at least one result and move out all the finished ones (at most "max")
+     * A failed slot is only taken as the first one of a batch, and then its exception is rethrown.
+     * @param out the results are appended to it
+     * @return the number of the results taken, zero if there is no result left and no task pending
+     */
+    size_t popBatch(std::vector<T>& out, size_t max = std::numeric_limits<size_t>::max()) {
+        std::unique_lock<std::mutex> lock(locker);
+        waitReady(lock);
+        size_t numb = 0;
+        while (numb < max && !items.empty()) {
+            if (items.front().failed() && numb) {
+                break;
+            }
+            out.emplace_back(takeFront());
+            numb++;
+        }
+        return numb;
+    }
+
+    // get the number of unfinished tasks
+    int getTasksRemain() const {
+        return pending.load();
+    }
+
+    // get the number of the results waiting to be popped
+    int size() const {
+        return ready_numb.load();
+    }
+
+private:
+    template <typename F>
+    Member<typename std::decay<F>::type> wrap(F&& foo) {
+        return Member<typename std::decay<F>::type>(std::forward<F>(foo), this);
+    }
+
+    // the last thing a task does with the queue, it may be destroyed once the locker is released
+    void put(Item&& item) {
+        std::lock_guard<std::mutex> lock(locker);
+        items.emplace_back(std::move(item));
+        ready_numb++;
+        pending--;
+        if (sleepers) {
+            ready_cv.notify_all();
+        }
+    }
+
+    // uncount a task that leaves no result
+    void cancel() {
+        std::lock_guard<std::mutex> lock(locker);
+        pending--;
+        if (sleepers) {
+            ready_cv.notify_all();
+        }
+    }
+
+    // wait until there is a result or no task pending, another consumer may take the result while the locker is released
+    void waitReady(std::unique_lock<std::mutex>& lock) {
+        auto ready = [this] { return ready_numb.load() > 0 || !pending.load(); };
+        while (items.empty() && pending.load()) {
+            lock.unlock();
+            bool helped = util::WorkerHelper::current().helpUntil(ready);
+            lock.lock();
+            if (!helped) {
+                sleepers++;
+                ready_cv.wait(lock, [this] { return !items.empty() || !pending.load(); });
+                sleepers--;
+            }
+        }
+    }
+
+    // called with the locker held
+    T takeFront() {
+        Item item(std::move(items.front()));
+        items.pop_front();
+        ready_numb--;
+        return item.take();
+    }
+};
+
+} // namespace hipe
@@ -0,0 +1,344 @@
+#pragma once
+
+// The coroutine support needs C++20, this header is empty for the older standards
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define HIPE_HAS_COROUTINE 1
+#endif
+#endif
+
+#ifdef HIPE_HAS_COROUTINE
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+namespace hipe {
+
+template <typename T = void>
+class task;
+
+namespace util {
+
+/**
+ * The task that resumes a coroutine on a worker.
+ * It only holds the coroutine handle so it always fits inline in util::Task, resuming needs no allocation.
+ * If the task is dropped without running (such as an overflow task), the coroutine will never be resumed.
+ */
+class ResumeTask
+{
+    std::coroutine_handle<> handle;
+
+public:
+    explicit ResumeTask(std::coroutine_handle<> h) noexcept
+      : handle(h) {
+    }
+
+    void operator()() {
+        handle.resume();
+    }
+};
+
+/**
+ * The fixed ponds wait for capacity instead of overflowing, so that the coroutine is not lost.
+ * But a worker of a full pond keeps running the coroutine, as it may be the one to free the capacity.
+ * @return false if the coroutine should be resumed on the calling thread
+ */
+template <typename Pond>
+auto postResume(Pond& pond, ResumeTask t, int) -> decltype(pond.trySubmit(t)) {
+    if (pond.trySubmit(t)) {
+        return true;
+    }
+    if (pond.isInPond()) {
+        return false;
+    }
+    pond.submitBlocking(t);
+    return true;
+}
+
+template <typename Pond>
+bool postResume(Pond& pond, ResumeTask t, long) {
+    pond.submit(t);
+    return true;
+}
+
+/**
+ * Awaitable returned by pond.schedule(), the coroutine awaiting it is resumed on a worker of the pond.
+ */
+template <typename Pond>
+class ScheduleAwaiter
+{
+    Pond* pond;
+
+public:
+    explicit ScheduleAwaiter(Pond& owner) noexcept
+      : pond(&owner) {
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> h) {
+        return postResume(*pond, ResumeTask(h), 0);
+    }
+
+    void await_resume() const noexcept {
+    }
+};
+
+
+// common part of the promises of hipe::task
+class TaskPromiseBase
+{
+    // the coroutine awaiting this one
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+
+protected:
+    std::exception_ptr error = nullptr;
+
+public:
+    // resume the awaiting coroutine directly on the finishing thread
+    struct FinalAwaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            return h.promise().continuation;
+        }
+
+        void await_resume() const noexcept {
+        }
+    };
+
+    // a task starts when it is awaited
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        error = std::current_exception();
+    }
+
+    void setContinuation(std::coroutine_handle<> h) noexcept {
+        continuation = h;
+    }
+};
+
+template <typename T>
+class TaskPromise : public TaskPromiseBase
+{
+    std::optional<T> value;
+
+public:
+    task<T> get_return_object() noexcept;
+
+    template <typename U>
+    void return_value(U&& val) {
+        value.emplace(std::forward<U>(val));
+    }
+
+    T result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template <>
+class TaskPromise<void> : public TaskPromiseBase
+{
+public:
+    task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {
+    }
+
+    void result() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+} // namespace util
+
+
+/**
+ * @brief A lazy coroutine that returns T.
+ * It starts when it is awaited, and once it finishes the awaiting coroutine is resumed on the same thread, no thread is
+ * blocked for the result. The exception thrown by the coroutine is rethrown by co_await.
+ * Use co_await pond.schedule() in it to move to a worker of a pond, and syncWait() to wait for it outside coroutines.
+ */
+template <typename T>
+class task
+{
+public:
+    using promise_type = util::TaskPromise<T>;
+
+private:
+    std::coroutine_handle<promise_type> handle = nullptr;
+
+public:
+    task() = default;
+
+    explicit task(std::coroutine_handle<promise_type> h) noexcept
+      : handle(h) {
+    }
+
+    task(task&& other) noexcept
+      : handle(std::exchange(other.handle, nullptr)) {
+    }
+
+    task& operator=(task&& other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    task(const task&) = delete;
+    task& operator=(const task&) = delete;
+
+    ~task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    bool valid() const noexcept {
+        return static_cast<bool>(handle);
+    }
+
+    // awaiting an invalid task throws std::future_error of no_state, as hipe::Future does
+    auto operator co_await() {
+        if (!handle) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() const noexcept {
+                return handle.done();
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().setContinuation(awaiting);
+                return handle;
+            }
+
+            T await_resume() {
+                return handle.promise().result();
+            }
+        };
+        return Awaiter{handle};
+    }
+};
+
+
+namespace util {
+
+template <typename T>
+task<T> TaskPromise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline task<void> TaskPromise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// a coroutine that starts at once and destroys itself when it finishes
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() const noexcept {
+            return {};
+        }
+        std::suspend_never initial_suspend() const noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() const noexcept {
+            return {};
+        }
+        void return_void() const noexcept {
+        }
+        void unhandled_exception() const noexcept {
+            std::terminate();
+        }
+    };
+};
+
+// result of a task waited by syncWait()
+template <typename T>
+struct SyncState {
+    std::mutex locker;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error = nullptr;
+    std::optional<T> value;
+};
+
+template <>
+struct SyncState<void> {
+    std::mutex locker;
+    std::condition_variable cv;
+    bool done = false;
+    std::exception_ptr error = nullptr;
+};
+
+template <typename T>
+Detached runSync(task<T>& t, SyncState<T>& state) {
+    try {
+        if constexpr (std::is_void<T>::value) {
+            co_await t;
+        } else {
+            state.value.emplace(co_await t);
+        }
+    } catch (...) {
+        state.error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> lock(state.locker);
+    state.done = true;
+    state.cv.notify_one();
+}
+
+} // namespace util
+
+
+/**
+ * @brief run a task and block the calling thread until it finishes
+ * Only for the threads that are not coroutines, such as the main thread. Don't call it on a worker of the pond the task
+ * is scheduled on, unless there are enough threads left.
+ */
+template <typename T>
+T syncWait(task<T> t) {
+    util::SyncState<T> state;
+    util::runSync(t, state);
+    {
+        std::unique_lock<std::mutex> lock(state.locker);
+        state.cv.wait(lock, [&state] { return state.done; });
+    }
+    if (state.error) {
+        std::rethrow_exception(state.error);
+    }
+    if constexpr (!std::is_void<T>::value) {
+        return std::move(*state.value);
+    }
+}
+
+} // namespace hipe
+
+#endif // HIPE_HAS_COROUTINE
@@ -1,5 +1,6 @@
 #pragma once
 #include "header.h"
+#include "./autoscale.h"
 
 
 namespace hipe {
@@ -7,9 +8,18 @@ namespace hipe {
 
 /**
  * @brief A dynamic thread pond
+ * The task queue is split into shards locked separately (by mutexes, as the threads may be more than the cpus). The producers put the tasks into the shards in turn, and
+ * each thread takes tasks from its own shard first and then from the others.
  */
 class DynamicThreadPond
 {
+    // a shard of the task queue
+    struct Shard {
+        std::mutex locker;
+        std::queue<HipeTask> tq;
+        std::atomic_int size = {0};
+        char pad[HIPE_CACHE_LINE];
+    };
 
     // stop the pond
     bool stop = {false};
@@ -20,26 +30,33 @@ class DynamicThreadPond
     // expect running thread number
     std::atomic_int expect_tnumb = {0};
 
-    // waiting for task done
-    bool is_waiting_for_task = {false};
-
-    // waiting for threads deleted
-    bool is_waiting_for_thread = {false};
-
     // task number
     std::atomic_int total_tasks = {0};
 
-    // shared task queue
-    std::queue<HipeTask> shared_tq = {};
+    // drop the tasks instead of running them, set when the pond is closed with CloseMode::cancel_and_drain
+    std::atomic<bool> dropping = {false};
+
+    // shards of the task queue, the number is a power of 2
+    std::unique_ptr<Shard[]> shards;
+    int shard_numb = 1;
+
+    // number of the tasks in the shards
+    std::atomic_int queued = {0};
+
+    // number of the threads started, used to spread their own shards
+    std::atomic_int started_numb = {0};
 
-    // locker shared by threads
+    // number of the threads sleeping on "awake_cv", the producers only notify if there are some
+    std::atomic_int sleepers = {0};
+
+    // locker shared by threads, which protects the thread list and the condition variables
     std::mutex shared_locker;
 
     // cv to awake the paused thread
     std::condition_variable awake_cv = {};
 
     // task done
-    std::condition_variable task_done_cv = {};
+    util::EventCount task_done;
 
     // thread started or deleted
     std::condition_variable thread_cv = {};
@@ -53,9 +70,41 @@ class DynamicThreadPond
     // the shrinking number of threads
     std::atomic_int shrink_numb = {0};
 
+    // threads parked in the reserve, and the threads taken out of it but not woken yet (protected by "shared_locker")
+    std::atomic_int parked_numb = {0};
+    int unpark_numb = 0;
+
+    // the most threads parked in the reserve (protected by "shared_locker")
+    int reserve_limit = 0;
+
+    // cv to unpark the reserved threads
+    std::condition_variable reserve_cv = {};
+
     // number of the tasks loaded by thread
     std::atomic_int tasks_loaded = {0};
 
+    // a thread sleeping for so many nanoseconds releases the storage of the shards, zero means never
+    std::atomic<uint64_t> reclaim_ns = {0};
+
+    // the storage has been released since the last task
+    std::atomic<bool> reclaimed = {false};
+
+    // timer wheel of the delayed and periodic tasks, created on first use
+    std::unique_ptr<util::TimerWheel> timer;
+    std::once_flag timer_flag;
+
+    // auto-scaling controller created on first use, and the pointer the threads see while it is enabled
+    std::unique_ptr<util::AutoScaler> scaler;
+    std::once_flag scaler_flag;
+    std::atomic<util::AutoScaler*> active_scaler = {nullptr};
+
+    // threads running tasks and the time spent on the finished ones, only counted while auto-scaling
+    std::atomic_int busy_tnumb = {0};
+    std::atomic<int64_t> busy_ns = {0};
+
+    // tasks loaded at the last check of the controller
+    int last_loaded = 0;
+
 
 public:
     /**
@@ -63,6 +112,12 @@ public:
      * @param tnumb initial thread number
      */
     explicit DynamicThreadPond(int tnumb = 0) {
+        // one shard for each cpu or initial thread
+        int numb = std::max(tnumb, static_cast<int>(std::thread::hardware_concurrency()));
+        while (shard_numb < numb && shard_numb < max_shard_numb) {
+            shard_numb <<= 1;
+        }
+        shards.reset(new Shard[shard_numb]);
         addThreads(tnumb);
     }
 
@@ -75,10 +130,25 @@ public:
 public:
     /**
      * @brief close the pond
-     * Tasks blocking in the queue will be thrown.
+     * Tasks blocking in the queue will be thrown by default.
+     * @param mode CloseMode::drain runs them before closing, and CloseMode::cancel_and_drain drops them
      */
-    void close() {
-        stop = true;
+    void close(CloseMode mode = CloseMode::discard) {
+        if (timer) {
+            timer->close();
+        }
+        disableAutoScaling();
+        if (mode == CloseMode::cancel_and_drain) {
+            dropping = true;
+        }
+        if (mode != CloseMode::discard) {
+            waitForTasks();
+        }
+        {
+            HipeLockGuard lock(shared_locker);
+            stop = true;
+            reserve_cv.notify_all();
+        }
         adjustThreads(0);
         waitForThreads();
         joinDeadThreads();
@@ -87,15 +157,65 @@ public:
     /**
      * @brief add threads
      * @param tnumb thread number
-     * The pond will expand through creating new thread.
+     * The pond will expand through unparking the threads in the reserve first, and then creating new threads.
      */
     void addThreads(int tnumb = 1) {
         assert(tnumb >= 0);
         expect_tnumb += tnumb;
         HipeLockGuard lock(shared_locker);
+        int numb = std::min(tnumb, parked_numb.load());
+        if (numb > 0) {
+            parked_numb -= numb;
+            unpark_numb += numb;
+            running_tnumb += numb;
+            tnumb -= numb;
+            reserve_cv.notify_all();
+        }
         while (tnumb--) {
-            pond.emplace_back(&DynamicThreadPond::worker, this, pond.rbegin());
+            // the thread keeps the iterator of its own object, which is assigned before the thread takes the locker
+            // the thread is counted before it starts, so that waitForThreads() can't miss an unstarted thread
+            running_tnumb++;
+            pond.emplace_back();
+            pond.back() = std::thread(&DynamicThreadPond::worker, this, std::prev(pond.end()), false);
+        }
+    }
+
+    /**
+     * @brief keep some threads parked instead of deleting them
+     * The shrinking threads park in the reserve while it is not full, and addThreads() takes the parked threads first,
+     * so growing costs a wakeup instead of creating a thread. The reserve is filled up with new parked threads at once.
+     * @param numb the most threads parked, zero to delete the shrinking threads (default)
+     */
+    void setThreadReserve(int numb) {
+        assert(numb >= 0);
+        HipeLockGuard lock(shared_locker);
+        reserve_limit = numb;
+        while (!stop && parked_numb.load() < numb) {
+            parked_numb++;
+            pond.emplace_back();
+            pond.back() = std::thread(&DynamicThreadPond::worker, this, std::prev(pond.end()), true);
         }
+        // the threads beyond the reserve leave
+        reserve_cv.notify_all();
+    }
+
+    /**
+     * @brief release the storage the shards kept for a past spike once the pond is idle for a while
+     * A thread that sleeps for the whole period frees the memory of the empty shards, and returns the free heap to the
+     * system where the allocator supports it (glibc's malloc_trim).
+     * @param idle the period, zero to keep the storage (default)
+     */
+    template <typename Rep, typename Period>
+    void setIdleReclaim(const std::chrono::duration<Rep, Period>& idle) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count();
+        reclaim_ns.store(static_cast<uint64_t>(std::max<decltype(ns)>(0, ns)));
+        HipeLockGuard lock(shared_locker);
+        awake_cv.notify_all();
+    }
+
+    // get the number of the threads parked in the reserve
+    int getParkedThreadNumb() const {
+        return parked_numb.load();
     }
 
 
@@ -132,8 +252,12 @@ public:
 
     // join dead threads to recycle thread resource
     void joinDeadThreads() {
-        while (!dead_threads.empty()) {
+        while (true) {
             shared_locker.lock();
+            if (dead_threads.empty()) {
+                shared_locker.unlock();
+                break;
+            }
             auto t = std::move(dead_threads.front());
             dead_threads.pop();
             shared_locker.unlock();
@@ -171,21 +295,52 @@ public:
     }
 
 
+    /**
+     * @brief let the pond grow and shrink by itself
+     * The controller checks the queue depth, the rate the tasks are loaded and the time the threads are blocked in
+     * tasks. It grows the pond for a burst within a few milliseconds and shrinks it slowly. Don't adjust the threads
+     * by hand while auto-scaling, as the controller will take them back into the range.
+     * @param options thread range, interval, cooldowns and where the controller runs
+     * @param policy return the thread number wanted for a sample, nullptr for the default one
+     * In the piggyback mode the pond only shrinks while there are tasks coming.
+     */
+    void enableAutoScaling(const AutoScaleOptions& options = AutoScaleOptions(), ScalePolicy policy = nullptr) {
+        std::call_once(scaler_flag, [this] {
+            scaler.reset(new util::AutoScaler([this](double window) { return sampleLoad(window); },
+                                              [this](int target) {
+                                                  adjustThreads(target);
+                                                  joinDeadThreads();
+                                              }));
+        });
+        active_scaler.store(nullptr);
+        scaler->enable(options, std::move(policy));
+        active_scaler.store(scaler.get());
+    }
+
+    // stop auto-scaling, the thread number stays as it is
+    void disableAutoScaling() {
+        active_scaler.store(nullptr);
+        if (scaler) {
+            scaler->close();
+        }
+    }
+
+    bool isAutoScaling() const {
+        return active_scaler.load() != nullptr;
+    }
+
+
     // wait for threads adjust
     void waitForThreads() {
-        is_waiting_for_thread = true;
         HipeUniqGuard locker(shared_locker);
-        thread_cv.wait(locker, [this] { return expect_tnumb == running_tnumb; });
-        is_waiting_for_thread = false;
+        // the parked threads leave once the pond is stopped
+        thread_cv.wait(locker, [this] { return expect_tnumb == running_tnumb && (!stop || !parked_numb); });
     }
 
 
     // wait for tasks in the pond done
     void waitForTasks() {
-        is_waiting_for_task = true;
-        HipeUniqGuard locker(shared_locker);
-        task_done_cv.wait(locker, [this] { return !total_tasks; });
-        is_waiting_for_task = false;
+        task_done.wait([this] { return !total_tasks; });
     }
 
     /**
@@ -194,12 +349,20 @@ public:
      */
     template <typename Runnable>
     void submit(Runnable&& foo) {
-        {
-            HipeLockGuard lock(shared_locker);
-            shared_tq.emplace(std::forward<Runnable>(foo));
-            ++total_tasks;
-        }
-        awake_cv.notify_one();
+        pollScaler();
+        ++total_tasks;
+        pushTask(nextShard(), std::forward<Runnable>(foo));
+        queued++;
+        wakeSleepers(1);
+    }
+
+    /**
+     * @brief submit task with a cancellation token
+     * The task is skipped if the token has been cancelled when a thread reaches it.
+     */
+    template <typename Runnable>
+    void submit(Runnable&& foo, const CancellationToken& token) {
+        submit(withToken(token, std::forward<Runnable>(foo)));
     }
 
     /**
@@ -208,16 +371,15 @@ public:
      * @return a future
      */
     template <typename Runnable>
-    auto submitForReturn(Runnable&& foo) -> std::future<typename std::result_of<Runnable()>::type> {
+    auto submitForReturn(Runnable&& foo) -> Future<typename std::result_of<Runnable()>::type> {
         using RT = typename std::result_of<Runnable()>::type;
-        std::packaged_task<RT()> pack(std::forward<Runnable>(foo));
-        std::future<RT> fut(pack.get_future());
-        {
-            HipeLockGuard lock(shared_locker);
-            shared_tq.emplace(std::move(pack));
-            ++total_tasks;
-        }
-        awake_cv.notify_one();
+        Future<RT> fut;
+        auto task = util::packTask(std::forward<Runnable>(foo), fut);
+        pollScaler();
+        ++total_tasks;
+        pushTask(nextShard(), std::move(task));
+        queued++;
+        wakeSleepers(1);
         return fut;
     }
 
@@ -228,66 +390,313 @@ public:
      */
     template <typename Container_>
     void submitInBatch(Container_& cont, size_t size) {
-        {
-            HipeLockGuard lock(shared_locker);
-            total_tasks += static_cast<int>(size);
-            for (size_t i = 0; i < size; ++i) {
-                shared_tq.emplace(std::move(cont[i]));
+        submitInBatch(cont, 0, size);
+    }
+
+    // submit the tasks in [begin, end) of the container
+    template <typename Container_>
+    void submitInBatch(Container_& cont, size_t begin, size_t end) {
+        if (begin >= end) {
+            return;
+        }
+        int size = static_cast<int>(end - begin);
+        pollScaler();
+        total_tasks += size;
+
+        // spread the batch over the shards in chunks
+        size_t chunk = (end - begin + shard_numb - 1) / shard_numb;
+        for (size_t i = begin; i < end; i += chunk) {
+            size_t last = std::min(end, i + chunk);
+            Shard& shard = nextShard();
+            {
+                HipeLockGuard lock(shard.locker);
+                for (size_t j = i; j < last; ++j) {
+                    shard.tq.emplace(std::move(cont[j]));
+                }
+                shard.size += static_cast<int>(last - i);
             }
         }
-        awake_cv.notify_all();
+        queued += size;
+        wakeSleepers(size);
+    }
+
+    /**
+     * @brief (C++20) resume the coroutine on a thread of the pond: co_await pond.schedule();
+     */
+    template <typename Pond = DynamicThreadPond>
+    util::ScheduleAwaiter<Pond> schedule() {
+        return util::ScheduleAwaiter<Pond>(*this);
+    }
+
+    /**
+     * @brief submit task after a delay
+     * The timers of the pond share one timing wheel, the expired tasks are submitted in batches.
+     * @param delay the time to wait
+     * @param foo a runnable object
+     * @return a handle to cancel the task before it expires
+     */
+    template <typename Rep, typename Period, typename Runnable>
+    TimerHandle submitAfter(const std::chrono::duration<Rep, Period>& delay, Runnable&& foo) {
+        auto d = std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+        return TimerHandle(getTimer().add(d, std::chrono::steady_clock::duration::zero(), std::forward<Runnable>(foo)));
+    }
+
+    /**
+     * @brief submit task every period
+     * The task runs first after one period, and the next period starts after the last run finished.
+     * @param period the period
+     * @param foo a runnable object
+     * @return a handle to stop the task
+     */
+    template <typename Rep, typename Period, typename Runnable>
+    TimerHandle submitEvery(const std::chrono::duration<Rep, Period>& period, Runnable&& foo) {
+        auto d = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        return TimerHandle(getTimer().add(d, d, std::forward<Runnable>(foo)));
     }
 
 
 private:
-    using Iter = std::list<std::thread>::reverse_iterator;
+    using Iter = std::list<std::thread>::iterator;
 
-    void notifyThreadAdjust() {
-        HipeLockGuard lock(shared_locker);
-        thread_cv.notify_one();
+    static constexpr int max_shard_numb = 64;
+
+    // rounds an idle thread spins before sleeping
+    static constexpr int spin_limit = 64;
+
+    // run a task unless the pond is dropping its tasks
+    void invokeTask(HipeTask& task) {
+        if (!dropping.load(std::memory_order_relaxed)) {
+            util::invoke(task);
+        } else {
+            // destroy the dropped task before it is counted as done, so its future has got broken_promise by then
+            HipeTask dropped(std::move(task));
+        }
+    }
+
+    // the shard for the calling producer to put the next task
+    Shard& nextShard() {
+        static thread_local unsigned cursor = 0;
+        return shards[cursor++ & static_cast<unsigned>(shard_numb - 1)];
+    }
+
+    template <typename T>
+    void pushTask(Shard& shard, T&& task) {
+        HipeLockGuard lock(shard.locker);
+        shard.tq.emplace(std::forward<T>(task));
+        shard.size++;
+    }
+
+    // take a task from the shards, starting from the thread's own one
+    bool popTask(int home, HipeTask& out) {
+        for (int i = 0; i < shard_numb; ++i) {
+            Shard& shard = shards[(home + i) & (shard_numb - 1)];
+            if (!shard.size.load(std::memory_order_relaxed)) {
+                continue;
+            }
+            HipeLockGuard lock(shard.locker);
+            if (!shard.tq.empty()) {
+                out = std::move(shard.tq.front());
+                shard.tq.pop();
+                shard.size--;
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Wake up the sleeping threads for the new tasks.
+     * A thread increases "sleepers" before checking "queued", and the producer increases "queued" before checking
+     * "sleepers", so at least one of them sees the other.
+     */
+    void wakeSleepers(int numb) {
+        if (sleepers.load()) {
+            HipeLockGuard lock(shared_locker);
+            if (numb > 1) {
+                awake_cv.notify_all();
+            } else {
+                awake_cv.notify_one();
+            }
+        }
+    }
+
+    // release the storage of the empty shards, once for an idle period
+    void reclaimStorage() {
+        if (reclaimed.exchange(true)) {
+            return;
+        }
+        for (int i = 0; i < shard_numb; ++i) {
+            HipeLockGuard lock(shards[i].locker);
+            if (shards[i].tq.empty()) {
+                std::queue<HipeTask>().swap(shards[i].tq);
+            }
+        }
+        util::trimHeap();
+    }
+
+    // take one of the shrinking number
+    bool tryShrink() {
+        int numb = shrink_numb.load();
+        while (numb > 0) {
+            if (shrink_numb.compare_exchange_weak(numb, numb - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // get the timer wheel, which hands the expired tasks to the pond in batches
+    util::TimerWheel& getTimer() {
+        std::call_once(timer_flag, [this] {
+            timer.reset(new util::TimerWheel([this](std::vector<HipeTask>& tasks) { submitInBatch(tasks, tasks.size()); }));
+        });
+        return *timer;
+    }
+
+    // (piggyback mode) give the controller a chance to check the pond, the producers do it before pushing tasks
+    void pollScaler() {
+        if (util::AutoScaler* sc = active_scaler.load(std::memory_order_acquire)) {
+            sc->poll();
+        }
+    }
+
+    // take a sample for the controller
+    ScaleSample sampleLoad(double window) {
+        ScaleSample s;
+        s.threads = expect_tnumb.load();
+        s.busy = busy_tnumb.load();
+        s.queued = std::max(0, queued.load());
+        s.window = window;
+
+        // tasks_loaded may have been reset by the user
+        int loaded = tasks_loaded.load();
+        int numb = (loaded >= last_loaded) ? loaded - last_loaded : loaded;
+        last_loaded = loaded;
+
+        double busy_time = static_cast<double>(busy_ns.exchange(0)) / 1e9;
+        if (window > 0.0 && s.threads > 0) {
+            s.rate = numb / window;
+            double busy = std::max(busy_time / window, static_cast<double>(s.busy));
+            s.utilization = std::min(1.0, busy / s.threads);
+        }
+        return s;
+    }
+
+    // move the thread object to the dead threads, called by the thread itself with "shared_locker" held
+    void retire(Iter it) {
+        dead_threads.emplace(std::move(*it)); // save std::thread
+        pond.erase(it);
+        thread_cv.notify_all();
+    }
+
+    /**
+     * Wait in the reserve until the thread is unparked, the pond is stopped or the reserve is reduced.
+     * @return true if the thread should work again
+     */
+    bool waitInReserve(HipeUniqGuard& lock) {
+        reserve_cv.wait(lock, [this] { return unpark_numb > 0 || stop || parked_numb.load() > reserve_limit; });
+        if (unpark_numb > 0) {
+            unpark_numb--;
+            return true;
+        }
+        parked_numb--;
+        return false;
+    }
+
+    /**
+     * Park a shrinking thread in the reserve, or delete it if the reserve is full.
+     * @return true if the thread has been unparked to work again
+     */
+    bool shrink(Iter it) {
+        HipeUniqGuard lock(shared_locker);
+        running_tnumb--;
+        if (!stop && parked_numb.load() < reserve_limit) {
+            parked_numb++;
+            thread_cv.notify_all();
+            if (waitInReserve(lock)) {
+                return true;
+            }
+        }
+        retire(it);
+        return false;
     }
 
     // working threads' default loop
-    void worker(Iter it) {
+    void worker(Iter it, bool reserved) {
         // task container
         HipeTask task;
 
-        running_tnumb++;
-        if (is_waiting_for_thread) {
-            notifyThreadAdjust();
+        // own shard of the thread
+        int home = started_numb++ & (shard_numb - 1);
+        int idle_rounds = 0;
+
+        // a thread created for the reserve starts parked
+        if (reserved) {
+            HipeUniqGuard lock(shared_locker);
+            if (!waitInReserve(lock)) {
+                retire(it);
+                return;
+            }
         }
 
         do {
-            HipeUniqGuard locker(shared_locker);
-            awake_cv.wait(locker, [this] { return !shared_tq.empty() || shrink_numb > 0; });
-
             // receive deletion inform
-            if (shrink_numb) {
-                shrink_numb--;
-                dead_threads.emplace(std::move(*it)); // save std::thread
-                pond.erase((++it).base());
-                break;
+            if (shrink_numb.load() > 0 && tryShrink()) {
+                if (shrink(it)) {
+                    continue;
+                }
+                return;
+            }
+            if (!popTask(home, task)) {
+                // spin for a while and then sleep until new tasks come
+                if (idle_rounds < spin_limit) {
+                    idle_rounds++;
+                    HIPE_PAUSE();
+                    continue;
+                }
+                idle_rounds = 0;
+                sleepers++;
+                bool timeout = false;
+                {
+                    auto ready = [this] { return queued.load() > 0 || shrink_numb.load() > 0; };
+                    uint64_t idle = reclaim_ns.load(std::memory_order_relaxed);
+                    HipeUniqGuard locker(shared_locker);
+                    if (idle && !reclaimed.load(std::memory_order_relaxed)) {
+                        timeout = !awake_cv.wait_for(locker, std::chrono::nanoseconds(idle), ready);
+                    } else {
+                        awake_cv.wait(locker, ready);
+                    }
+                }
+                sleepers--;
+                if (timeout) {
+                    reclaimStorage();
+                }
+                continue;
             }
-            task = std::move(shared_tq.front());
-            shared_tq.pop();
-            locker.unlock();
+            idle_rounds = 0;
 
             tasks_loaded++;
+            if (reclaimed.load(std::memory_order_relaxed)) {
+                reclaimed.store(false, std::memory_order_relaxed);
+            }
 
-            util::invoke(task);
-            --total_tasks;
-
-            if (is_waiting_for_task) {
-                HipeLockGuard lock(shared_locker);
-                task_done_cv.notify_one();
+            util::AutoScaler* sc = active_scaler.load(std::memory_order_acquire);
+            if (sc) {
+                sc->poll();
+                busy_tnumb++;
+                auto begin = std::chrono::steady_clock::now();
+                invokeTask(task);
+                busy_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+                busy_tnumb--;
+            } else {
+                invokeTask(task);
+            }
+            if (--total_tasks == 0) {
+                task_done.notifyAll();
             }
 
         } while (true);
-
-        running_tnumb--;
-        if (is_waiting_for_thread) {
-            notifyThreadAdjust();
-        }
     }
 };
 
@@ -0,0 +1,555 @@
+#pragma once
+#include "./util.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <future>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+
+namespace hipe {
+
+template <typename T>
+class Future;
+
+template <typename T>
+class Promise;
+
+namespace util {
+
+/**
+ * Shared state of hipe::Future and hipe::Promise.
+ * The waiting thread spins for a while, then yields and finally parks on the condition variable,
+ * the thread setting the result only touches the locker if there is a parked waiter or a continuation.
+ */
+class FutureStateBase
+{
+    std::atomic_int refs = {1};
+    std::atomic<bool> done = {false};
+    std::atomic<bool> has_waiter = {false};
+    std::atomic<bool> has_next = {false};
+    std::mutex locker;
+    std::condition_variable ready_cv;
+
+    // continuation called once the result is set
+    Task next;
+
+    static constexpr int spin_limit = 64;
+    static constexpr int yield_limit = 16;
+
+protected:
+    std::exception_ptr error = nullptr;
+
+public:
+    FutureStateBase() = default;
+    FutureStateBase(const FutureStateBase&) = delete;
+    FutureStateBase& operator=(const FutureStateBase&) = delete;
+    virtual ~FutureStateBase() = default;
+
+    void retain() {
+        refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void release() {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+
+    // whether the result has been set
+    bool ready() const {
+        return done.load(std::memory_order_acquire);
+    }
+
+    // wait until the result is set
+    void wait() {
+        // a worker of the fixed ponds runs the other tasks instead of blocking
+        if (WorkerHelper::current().helpUntil([this] { return ready(); })) {
+            return;
+        }
+        for (int i = 0; i < spin_limit + yield_limit; ++i) {
+            if (ready()) {
+                return;
+            }
+            if (i < spin_limit) {
+                HIPE_PAUSE();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        has_waiter.store(true);
+        std::unique_lock<std::mutex> lock(locker);
+        ready_cv.wait(lock, [this] { return done.load(); });
+    }
+
+    // wait for the result until timeout
+    template <typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout) {
+        if (ready()) {
+            return true;
+        }
+        has_waiter.store(true);
+        std::unique_lock<std::mutex> lock(locker);
+        return ready_cv.wait_for(lock, timeout, [this] { return done.load(); });
+    }
+
+    void setException(std::exception_ptr e) {
+        checkSatisfied();
+        error = std::move(e);
+        markReady();
+    }
+
+    // call the task once the result is set, or call it now if the result is ready
+    void onReady(Task&& task) {
+        {
+            std::lock_guard<std::mutex> lock(locker);
+            next = std::move(task);
+            has_next.store(true);
+        }
+        if (done.load()) {
+            runNext();
+        }
+    }
+
+    // set a broken promise error if the result will never be set
+    void abandon() {
+        if (!ready()) {
+            setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+protected:
+    void checkSatisfied() {
+        if (ready()) {
+            throw std::future_error(std::future_errc::promise_already_satisfied);
+        }
+    }
+
+    void markReady() {
+        done.store(true);
+        if (has_waiter.load()) {
+            std::lock_guard<std::mutex> lock(locker);
+            ready_cv.notify_all();
+        }
+        if (has_next.load()) {
+            runNext();
+        }
+    }
+
+    // both the setter and onReady may get here, only one of them takes the continuation
+    void runNext() {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(locker);
+            task = std::move(next);
+        }
+        if (task.is_set()) {
+            task();
+        }
+    }
+
+    void rethrow() {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+
+template <typename T>
+class FutureState : public FutureStateBase
+{
+    static_assert(!std::is_reference<T>::value, "[HipeError]: hipe::Future can not hold a reference");
+
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value;
+    bool has_value = false;
+
+public:
+    ~FutureState() override {
+        if (has_value) {
+            reinterpret_cast<T*>(&value)->~T();
+        }
+    }
+
+    template <typename U>
+    void setValue(U&& val) {
+        checkSatisfied();
+        ::new (&value) T(std::forward<U>(val));
+        has_value = true;
+        markReady();
+    }
+
+    // wait and move the result out
+    T take() {
+        wait();
+        rethrow();
+        return std::move(*reinterpret_cast<T*>(&value));
+    }
+};
+
+
+template <>
+class FutureState<void> : public FutureStateBase
+{
+public:
+    void setValue() {
+        checkSatisfied();
+        markReady();
+    }
+
+    void take() {
+        wait();
+        rethrow();
+    }
+};
+
+
+/**
+ * Shared state that embeds the runnable object, so that the task and its future cost only one allocation.
+ */
+template <typename F, typename R>
+class TaskState : public FutureState<R>
+{
+    F foo;
+
+    template <typename U = R>
+    typename std::enable_if<!std::is_void<U>::value>::type invoke() {
+        this->setValue(foo());
+    }
+
+    template <typename U = R>
+    typename std::enable_if<std::is_void<U>::value>::type invoke() {
+        foo();
+        this->setValue();
+    }
+
+public:
+    template <typename U>
+    explicit TaskState(U&& f)
+      : foo(std::forward<U>(f)) {
+    }
+
+    void run() {
+        try {
+            invoke();
+        } catch (...) {
+            this->setException(std::current_exception());
+        }
+    }
+};
+
+
+/**
+ * The runnable object submitted to the ponds, which is only a pointer and can be saved in the inline buffer of
+ * util::Task. If it is destroyed without running, the future will get a broken promise error.
+ */
+template <typename F, typename R>
+class StateRunner
+{
+    TaskState<F, R>* st = nullptr;
+
+public:
+    explicit StateRunner(TaskState<F, R>* state)
+      : st(state) {
+    }
+
+    StateRunner(StateRunner&& other) noexcept
+      : st(other.st) {
+        other.st = nullptr;
+    }
+
+    StateRunner(const StateRunner&) = delete;
+    StateRunner& operator=(const StateRunner&) = delete;
+
+    ~StateRunner() {
+        if (st) {
+            st->abandon();
+            st->release();
+        }
+    }
+
+    void operator()() {
+        st->run();
+    }
+};
+
+
+// the return type of a continuation
+template <typename F, typename T>
+struct ThenResult {
+    using type = typename std::result_of<F(T)>::type;
+};
+
+template <typename F>
+struct ThenResult<F, void> {
+    using type = typename std::result_of<F()>::type;
+};
+
+
+/**
+ * The callable object of a continuation, it takes the result of the former future and passes it to "foo".
+ * The exception of the former future is passed to the new one without calling "foo".
+ */
+template <typename F, typename T>
+class ThenCall
+{
+    FutureState<T>* src = nullptr;
+    F foo;
+
+public:
+    using result_type = typename ThenResult<F, T>::type;
+
+    ThenCall(FutureState<T>* state, F&& f)
+      : src(state)
+      , foo(std::move(f)) {
+    }
+
+    ThenCall(ThenCall&& other) noexcept(std::is_nothrow_move_constructible<F>::value)
+      : src(other.src)
+      , foo(std::move(other.foo)) {
+        other.src = nullptr;
+    }
+
+    ~ThenCall() {
+        if (src) {
+            src->release();
+        }
+    }
+
+    result_type operator()() {
+        return call(std::is_void<T>());
+    }
+
+private:
+    result_type call(std::false_type) {
+        return foo(src->take());
+    }
+
+    result_type call(std::true_type) {
+        src->take();
+        return foo();
+    }
+};
+
+
+// submit a continuation without throwing, a pond that refuses it leaves it to the calling thread
+template <typename Pond, typename Runner>
+auto submitContinuation(Pond& pond, Runner& runner, int) -> decltype(pond.trySubmit(std::move(runner)), void()) {
+    if (!pond.trySubmit(std::move(runner))) {
+        runner();
+    }
+}
+
+template <typename Pond, typename Runner>
+void submitContinuation(Pond& pond, Runner& runner, long) {
+    try {
+        pond.submit(std::move(runner));
+    } catch (...) {
+        // the runner left is destroyed without running, so the continuation gets a broken promise
+    }
+}
+
+
+/**
+ * Submit the task to the pond when it is called. It is called while the former result is being set, so it never
+ * throws, otherwise the setter would try to set the satisfied state again with the exception.
+ */
+template <typename Pond, typename Runner>
+struct Resubmit {
+    Pond* pond;
+    Runner runner;
+
+    void operator()() {
+        submitContinuation(*pond, runner, 0);
+    }
+};
+
+
+/**
+ * Wrap a runnable object into a task for the ponds and bind the future to its return.
+ * @param foo a runnable object
+ * @param fut the future to get the return
+ */
+template <typename F, typename R = typename std::result_of<F()>::type>
+StateRunner<typename std::decay<F>::type, R> packTask(F&& foo, Future<R>& fut) {
+    auto st = new TaskState<typename std::decay<F>::type, R>(std::forward<F>(foo));
+    st->retain();
+    fut = Future<R>(st);
+    return StateRunner<typename std::decay<F>::type, R>(st);
+}
+
+} // namespace util
+
+
+/**
+ * @brief A lightweight future returned by submitForReturn.
+ * The result can be got only once, just like std::future.
+ * A worker of the fixed ponds waiting for the result runs the other tasks of its pond meanwhile.
+ */
+template <typename T>
+class Future
+{
+    util::FutureState<T>* st = nullptr;
+
+public:
+    Future() = default;
+
+    // take over a reference of the shared state
+    explicit Future(util::FutureState<T>* state)
+      : st(state) {
+    }
+
+    Future(Future&& other) noexcept
+      : st(other.st) {
+        other.st = nullptr;
+    }
+
+    Future& operator=(Future&& other) noexcept {
+        if (this != &other) {
+            reset();
+            st = other.st;
+            other.st = nullptr;
+        }
+        return *this;
+    }
+
+    Future(const Future&) = delete;
+    Future& operator=(const Future&) = delete;
+
+    ~Future() {
+        reset();
+    }
+
+    // whether the future refers to a shared state
+    bool valid() const {
+        return st != nullptr;
+    }
+
+    // whether the result is ready
+    bool ready() const {
+        return st && st->ready();
+    }
+
+    // the waits and get() throw std::future_error of no_state on an invalid future, as std::future does
+    void wait() const {
+        checkState();
+        st->wait();
+    }
+
+    template <typename Rep, typename Period>
+    std::future_status wait_for(const std::chrono::duration<Rep, Period>& timeout) const {
+        checkState();
+        return st->waitFor(timeout) ? std::future_status::ready : std::future_status::timeout;
+    }
+
+    // wait and get the result, the future will be invalid after that
+    T get() {
+        checkState();
+        Holder holder(st);
+        st = nullptr;
+        return holder.st->take();
+    }
+
+    /**
+     * @brief submit "foo" to the pond once the result is ready, without blocking any thread.
+     * "foo" takes the result (or nothing if T is void) and the future will be invalid after that.
+     * If the result is an exception, "foo" will not be called and the exception goes to the returned future.
+     * @param pond the pond to run the continuation
+     * @param foo a callable object
+     * @return the future of the continuation
+     */
+    template <typename Pond, typename F>
+    auto then(Pond& pond, F&& foo) -> Future<typename util::ThenResult<typename std::decay<F>::type, T>::type> {
+        using Call = util::ThenCall<typename std::decay<F>::type, T>;
+        using R = typename Call::result_type;
+
+        checkState();
+        util::FutureState<T>* src = st;
+        st = nullptr;
+
+        Future<R> fut;
+        auto runner = util::packTask(Call(src, typename std::decay<F>::type(std::forward<F>(foo))), fut);
+        src->onReady(util::Resubmit<Pond, decltype(runner)>{&pond, std::move(runner)});
+        return fut;
+    }
+
+private:
+    struct Holder {
+        util::FutureState<T>* st;
+        explicit Holder(util::FutureState<T>* s)
+          : st(s) {
+        }
+        ~Holder() {
+            st->release();
+        }
+    };
+
+    void checkState() const {
+        if (!st) {
+            throw std::future_error(std::future_errc::no_state);
+        }
+    }
+
+    void reset() {
+        if (st) {
+            st->release();
+            st = nullptr;
+        }
+    }
+};
+
+
+/**
+ * @brief The promise to set the result of a hipe::Future.
+ */
+template <typename T>
+class Promise
+{
+    util::FutureState<T>* st = nullptr;
+    bool retrieved = false;
+
+public:
+    Promise()
+      : st(new util::FutureState<T>()) {
+    }
+
+    Promise(Promise&& other) noexcept
+      : st(other.st)
+      , retrieved(other.retrieved) {
+        other.st = nullptr;
+    }
+
+    Promise(const Promise&) = delete;
+    Promise& operator=(const Promise&) = delete;
+
+    ~Promise() {
+        if (st) {
+            st->abandon();
+            st->release();
+        }
+    }
+
+    // get the future bound to the promise, only once
+    Future<T> get_future() {
+        if (retrieved) {
+            throw std::future_error(std::future_errc::future_already_retrieved);
+        }
+        retrieved = true;
+        st->retain();
+        return Future<T>(st);
+    }
+
+    template <typename... U>
+    void set_value(U&&... val) {
+        st->setValue(std::forward<U>(val)...);
+    }
+
+    void set_exception(std::exception_ptr e) {
+        st->setException(std::move(e));
+    }
+};
+
+} // namespace hipe
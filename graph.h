@@ -0,0 +1,202 @@
+#pragma once
+#include "./future.h"
+#include "./util.h"
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+namespace hipe {
+
+/**
+ * @brief A graph of tasks that is run by any pond.
+ * Each node keeps an atomic counter of its unfinished predecessors, the last predecessor to finish submits the node
+ * to the pond, so no thread is blocked between the stages. A node refused by a full pond is run by the thread that
+ * got it ready instead. The graph can be run again after the last run is done, and it must outlive the runs.
+ */
+class TaskGraph
+{
+    struct Node {
+        util::Task task;
+        std::vector<size_t> successors;
+        int predecessors = 0;
+        std::atomic_int pending = {0};
+    };
+
+    std::vector<std::unique_ptr<Node>> nodes;
+
+    std::atomic_int remain = {0};
+    std::atomic<bool> failed = {false};
+    std::exception_ptr error = nullptr;
+
+    // the state of the future returned by run()
+    util::FutureState<void>* finish = nullptr;
+
+public:
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    ~TaskGraph() {
+        if (finish) {
+            finish->release();
+        }
+    }
+
+    /**
+     * @brief add a node
+     * @param foo a runnable object
+     * @return the id of the node
+     */
+    template <typename F>
+    size_t emplace(F&& foo) {
+        checkIdle();
+        std::unique_ptr<Node> node(new Node);
+        node->task.reset(std::forward<F>(foo));
+        nodes.push_back(std::move(node));
+        return nodes.size() - 1;
+    }
+
+    /**
+     * @brief make the node "from" run before the node "to"
+     */
+    void precede(size_t from, size_t to) {
+        checkIdle();
+        if (from >= nodes.size() || to >= nodes.size()) {
+            throw std::out_of_range("[HipeError]: node of the task graph out of range");
+        }
+        nodes[from]->successors.push_back(to);
+        nodes[to]->predecessors++;
+    }
+
+    // get the number of nodes
+    size_t size() const {
+        return nodes.size();
+    }
+
+    // whether the graph is running
+    bool isRunning() const {
+        return remain.load() != 0;
+    }
+
+    /**
+     * @brief run the graph with the pond
+     * If a node throws, the nodes not started will be skipped and the exception goes to the returned future.
+     * @return a future that is ready once all the nodes are done
+     */
+    template <typename Pond>
+    Future<void> run(Pond& pond) {
+        checkIdle();
+        checkAcyclic();
+
+        if (finish) {
+            finish->release();
+        }
+        finish = new util::FutureState<void>();
+        finish->retain();
+        Future<void> fut(finish);
+
+        if (nodes.empty()) {
+            finish->setValue();
+            return fut;
+        }
+
+        failed.store(false);
+        error = nullptr;
+        for (auto& node : nodes) {
+            node->pending.store(node->predecessors, std::memory_order_relaxed);
+        }
+        // one more than the nodes, the last node keeps the graph running until it has taken the result
+        remain.store(static_cast<int>(nodes.size()) + 1);
+
+        // collect the roots first, as the nodes may finish while submitting
+        std::vector<size_t> roots;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!nodes[i]->predecessors) {
+                roots.push_back(i);
+            }
+        }
+        for (auto id : roots) {
+            submitNode(pond, id);
+        }
+        return fut;
+    }
+
+private:
+    // a node refused by a full pond runs on the calling thread, so the graph always finishes
+    template <typename Pond>
+    void submitNode(Pond& pond, size_t id) {
+        auto task = [this, &pond, id] { runNode(pond, id); };
+        if (!util::trySubmitCounted(pond, task, 0)) {
+            task();
+        }
+    }
+
+    template <typename Pond>
+    void runNode(Pond& pond, size_t id) {
+        Node& node = *nodes[id];
+        if (!failed.load()) {
+            try {
+                node.task();
+            } catch (...) {
+                if (!failed.exchange(true)) {
+                    error = std::current_exception();
+                }
+            }
+        }
+        for (auto next : node.successors) {
+            if (nodes[next]->pending.fetch_sub(1) == 1) {
+                submitNode(pond, next);
+            }
+        }
+        if (remain.fetch_sub(1) == 2) {
+            // take the state and the result before going idle, as the graph may be run again after that
+            util::FutureState<void>* st = finish;
+            std::exception_ptr e = error;
+            st->retain();
+            remain.store(0);
+            if (e) {
+                st->setException(e);
+            } else {
+                st->setValue();
+            }
+            st->release();
+        }
+    }
+
+    void checkIdle() const {
+        if (isRunning()) {
+            throw std::logic_error("[HipeError]: the task graph is running");
+        }
+    }
+
+    // Kahn's algorithm
+    void checkAcyclic() const {
+        std::vector<int> degree(nodes.size());
+        std::vector<size_t> ready;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            degree[i] = nodes[i]->predecessors;
+            if (!degree[i]) {
+                ready.push_back(i);
+            }
+        }
+        size_t visited = 0;
+        while (!ready.empty()) {
+            size_t id = ready.back();
+            ready.pop_back();
+            visited++;
+            for (auto next : nodes[id]->successors) {
+                if (--degree[next] == 0) {
+                    ready.push_back(next);
+                }
+            }
+        }
+        if (visited != nodes.size()) {
+            throw std::logic_error("[HipeError]: the task graph has a cycle");
+        }
+    }
+};
+
+} // namespace hipe
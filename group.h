@@ -0,0 +1,184 @@
+#pragma once
+#include "./util.h"
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+namespace hipe {
+
+/**
+ * @brief A group of tasks that can be waited for, without waiting for the other tasks in the pond.
+ * The tasks are submitted to any pond through the group. Finishing a task only decreases an atomic counter, and the
+ * last one wakes up the waiting threads through an eventcount. A task that is dropped without running (such as a
+ * task cancelled by closing the pond) is also counted as finished. The group waits for its tasks while being destroyed.
+ * A worker of the fixed ponds waiting for a group runs the other tasks of its pond meanwhile, so the groups can be
+ * nested in the tasks. Waiting in a task of DynamicThreadPond still holds the thread.
+ */
+class TaskGroup
+{
+    std::atomic_int pending = {0};
+
+    // the last finishing tasks that may still touch the group
+    std::atomic_int exiting = {0};
+
+    util::EventCount done;
+
+    std::atomic<bool> failed = {false};
+    std::exception_ptr error = nullptr;
+
+    // a task of the group, which finishes once even if it is destroyed without running
+    template <typename F>
+    class Member
+    {
+        F foo;
+        TaskGroup* group;
+
+    public:
+        template <typename T>
+        Member(T&& tar, TaskGroup* owner)
+          : foo(std::forward<T>(tar))
+          , group(owner) {
+        }
+
+        Member(Member&& other) noexcept
+          : foo(std::move(other.foo))
+          , group(other.group) {
+            other.group = nullptr;
+        }
+
+        Member(const Member&) = delete;
+        Member& operator=(const Member&) = delete;
+
+        ~Member() {
+            if (group) {
+                group->finish();
+            }
+        }
+
+        void operator()() {
+            TaskGroup* owner = group;
+            group = nullptr;
+            try {
+                foo();
+            } catch (...) {
+                owner->fail(std::current_exception());
+            }
+            owner->finish();
+        }
+    };
+
+public:
+    TaskGroup() = default;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+    ~TaskGroup() {
+        waitDone();
+    }
+
+    /**
+     * @brief submit a task of the group to the pond
+     * @param pond any pond of hipe
+     * @param foo a runnable object
+     * @param args other arguments of the pond's submit(), such as the priority of BalancedThreadPond
+     * @throw std::runtime_error if the pond is full, the task is not counted then and the refuse callback is not called
+     */
+    template <typename Pond, typename F, typename... Args>
+    void submit(Pond& pond, F&& foo, Args&&... args) {
+        pending++;
+        auto task = wrap(std::forward<F>(foo));
+        if (!util::trySubmitCounted(pond, task, 0, std::forward<Args>(args)...)) {
+            // the refused task finishes here, so the group never waits for a task kept by the pond
+            throw std::runtime_error("[HipeError]: Task overflow while submitting task to the group");
+        }
+    }
+
+    /**
+     * @brief count a task into the group and return the wrapped one, which can be submitted in a batch
+     * The wrapped task must be run or destroyed, otherwise the group will never be done.
+     */
+    template <typename F>
+    Member<typename std::decay<F>::type> add(F&& foo) {
+        pending++;
+        return wrap(std::forward<F>(foo));
+    }
+
+    /**
+     * @brief wait for the tasks of the group
+     * If some tasks threw, the first exception is rethrown once.
+     */
+    void wait() {
+        waitDone();
+        if (failed.load()) {
+            std::exception_ptr tmp = error;
+            error = nullptr;
+            failed.store(false);
+            std::rethrow_exception(tmp);
+        }
+    }
+
+    /**
+     * @brief wait for the tasks of the group for a while
+     * @return false if there are tasks unfinished after the timeout
+     */
+    template <typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout) {
+        if (!done.waitFor(timeout, [this] { return !pending.load(); })) {
+            return false;
+        }
+        waitExiting();
+        return true;
+    }
+
+    // get the number of unfinished tasks
+    int getTasksRemain() const {
+        return pending.load();
+    }
+
+private:
+    template <typename F>
+    Member<typename std::decay<F>::type> wrap(F&& foo) {
+        return Member<typename std::decay<F>::type>(std::forward<F>(foo), this);
+    }
+
+    void finish() {
+        // not the last one, just leave
+        int numb = pending.load(std::memory_order_relaxed);
+        while (numb > 1) {
+            if (pending.compare_exchange_weak(numb, numb - 1)) {
+                return;
+            }
+        }
+        // the waiting thread may destroy the group once the counter is zero, so stay visible until notified
+        exiting++;
+        if (pending.fetch_sub(1) == 1) {
+            done.notifyAll();
+        }
+        exiting--;
+    }
+
+    void fail(std::exception_ptr e) {
+        if (!failed.exchange(true)) {
+            error = e;
+        }
+    }
+
+    void waitDone() {
+        if (!util::WorkerHelper::current().helpUntil([this] { return !pending.load(); })) {
+            done.wait([this] { return !pending.load(); });
+        }
+        waitExiting();
+    }
+
+    void waitExiting() {
+        while (exiting.load()) {
+            std::this_thread::yield();
+        }
+    }
+};
+
+} // namespace hipe
@@ -1,13 +1,22 @@
 #pragma once
+#include "./cancel.h"
+#include "./future.h"
+#include "./metrics.h"
+#include "./timer.h"
+#include "./topology.h"
+#include "./trace.h"
 #include "./util.h"
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <condition_variable>
 #include <cstddef>
+#include <fstream>
 #include <functional>
 #include <future>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <list>
 #include <memory>
 #include <mutex>
@@ -38,7 +47,33 @@ using HipeUniqGuard = std::unique_lock<std::mutex>;
 using HipeTimePoint = std::chrono::steady_clock::time_point;
 
 template <typename T>
-using HipeFutures = util::Futures<T>;
+using HipeFutures = util::Futures<T, Future<T>>;
+
+namespace util {
+// awaitable of pond.schedule(), defined in coroutine.h (C++20)
+template <typename Pond>
+class ScheduleAwaiter;
+} // namespace util
+
+/**
+ * @brief How an idle thread of the fixed ponds waits for new tasks.
+ * busy_spin: keep spinning, the lowest latency but an idle thread still occupies a core.
+ * spin_yield: spin for a while and then yield the cpu (default).
+ * spin_park: spin and yield for a while, then sleep until a new task arrives, nearly no cpu cost while idle.
+ */
+enum class WaitStrategy { busy_spin,
+                          spin_yield,
+                          spin_park };
+
+/**
+ * @brief What close() does with the tasks left in the pond.
+ * discard: stop at once, the tasks left are destroyed with the pond without running (default).
+ * drain: run all the tasks left and then stop.
+ * cancel_and_drain: drop all the tasks left without running them (the futures get broken promise errors), then stop.
+ */
+enum class CloseMode { discard,
+                       drain,
+                       cancel_and_drain };
 
 
 class ThreadPoolError : public std::exception
@@ -127,17 +162,150 @@ public:
 class ThreadBase
 {
 protected:
-    bool waiting = false;
+    std::atomic<bool> waiting = {false};
     AutoThread handle;
 
     std::atomic_int task_numb = {0};
-    std::condition_variable task_done_cv;
-    std::mutex cv_locker;
+    util::EventCount task_done;
+
+    // parking state of the thread, a producer only wakes the thread up when it is parked
+    std::atomic<bool> parked = {false};
+    std::condition_variable park_cv;
+    std::mutex park_locker;
+
+    // Lock-free deque used by the work-stealing mode and the tasks submitted by the thread itself.
+    // The owner runs the tasks in it LIFO, and the idle threads steal them FIFO.
+    util::WorkStealingDeque<HipeTask> local_tq{HIPE_LOCAL_DEQUE_SIZE};
+
+    // the pond owning the thread and the index in it, only accessed by the thread itself
+    const void* owner = nullptr;
+    int index = 0;
+
+    // notified when a task is done, set by the capacity-limited ponds for the producers waiting for capacity
+    util::EventCount* capacity_freed = nullptr;
+
+    // drop the tasks instead of running them, set when the pond is closed with CloseMode::cancel_and_drain
+    std::atomic<bool> dropping = {false};
+
+    // memory budget of the pond, which takes back the bytes of the tasks done
+    util::ByteBudget* budget = nullptr;
+
+    // (thread only) when the thread became idle, zero while it is running tasks and max after reclaiming the storage
+    uint64_t idle_since = 0;
+
+    // set while the thread is blocked in a BlockingRegion, the other threads take over its queued tasks meanwhile
+    std::atomic<bool> blocking = {false};
+
+public:
+    // seed to pick random threads in the pond
+    uint32_t seed = 1;
+
+#ifdef HIPE_ENABLE_METRICS
+    // counters of the thread, written by the thread itself
+    util::WorkerMetrics metrics;
+#endif
+
+#ifdef HIPE_ENABLE_TRACE
+    // latest events of the thread, written by the thread itself
+    util::TraceRing trace;
+#endif
 
 public:
     ThreadBase() = default;
     virtual ~ThreadBase() = default;
 
+    // thread object of the calling thread, nullptr if the calling thread is not a worker of the fixed ponds
+    static ThreadBase*& current() {
+        static thread_local ThreadBase* self = nullptr;
+        return self;
+    }
+
+    // called by the worker thread when it starts running
+    void enter(const void* pond, int idx) {
+        owner = pond;
+        index = idx;
+        seed = static_cast<uint32_t>(idx) + 1;
+        current() = this;
+        HIPE_METRICS(metrics.start());
+    }
+
+    const void* getOwner() const {
+        return owner;
+    }
+
+    // notify the signal once a task is done, called by the thread itself before running any task
+    void setCapacitySignal(util::EventCount* signal) {
+        capacity_freed = signal;
+    }
+
+    // give the bytes of the tasks done back to the budget, called by the thread itself before running any task
+    void setBudget(util::ByteBudget* tar) {
+        budget = tar;
+    }
+
+    /**
+     * Check whether the idle thread should release the storage of its queues, called by the thread itself.
+     * @param idle_ns how long the thread should be idle
+     * @return nanoseconds left before reclaiming, or zero if it is time to reclaim (only once for an idle period)
+     */
+    uint64_t reclaimCountdown(uint64_t idle_ns) {
+        if (idle_since == UINT64_MAX) {
+            return UINT64_MAX;
+        }
+        uint64_t now = util::nowNanos();
+        if (!idle_since) {
+            idle_since = now;
+        }
+        if (now - idle_since < idle_ns) {
+            return idle_ns - (now - idle_since);
+        }
+        idle_since = UINT64_MAX;
+        return 0;
+    }
+
+    // bytes a task takes in the queues as HipeTask, the thread classes keeping other kinds of tasks override it
+    static size_t bytesOf(const HipeTask& task) {
+        return task.footprint();
+    }
+
+    template <typename T>
+    static size_t bytesOf(const T&) {
+        return HipeTask::footprintOf<T>();
+    }
+
+    // release the storage of the empty queues, the thread classes that keep growable queues override it
+    void shrinkStorage() {
+    }
+
+    /**
+     * Put the tasks the thread has loaded but not started back where the other threads can take them, called by the
+     * thread itself before blocking. The thread classes that run a loaded batch in place override it.
+     */
+    void shedLoadedTasks() {
+    }
+
+    bool isBlocking() const {
+        return blocking.load(std::memory_order_relaxed);
+    }
+
+    void setBlocking(bool flag) {
+        blocking.store(flag);
+    }
+
+    // drop the tasks left without running them, they are still counted as done
+    void dropTasks() {
+        dropping.store(true);
+    }
+
+    // renew the local deque in the calling thread, so that its memory is allocated on the node of the thread
+    void placeLocal() {
+        local_tq.reset(HIPE_LOCAL_DEQUE_SIZE);
+    }
+
+    int getIndex() const {
+        return index;
+    }
+
     int getTasksNumb() {
         return task_numb.load();
     }
@@ -146,6 +314,37 @@ public:
         return !task_numb;
     }
 
+    /**
+     * Reserve the capacity for tasks that will be pushed later (atomic operation)
+     * @param numb task number
+     * @param capacity task capacity of the thread
+     */
+    bool tryReserve(int numb, int capacity) {
+        int old = task_numb.load(std::memory_order_relaxed);
+        do {
+            if (old + numb > capacity) {
+                return false;
+            }
+        } while (!task_numb.compare_exchange_weak(old, old + numb));
+        return true;
+    }
+
+    /**
+     * Reserve the capacity for at most "numb" tasks (atomic operation)
+     * @return the number of tasks reserved
+     */
+    int reserveUpTo(int numb, int capacity) {
+        int old = task_numb.load(std::memory_order_relaxed);
+        int got = 0;
+        do {
+            got = std::min(numb, capacity - old);
+            if (got <= 0) {
+                return 0;
+            }
+        } while (!task_numb.compare_exchange_weak(old, old + got));
+        return got;
+    }
+
     void join() {
         handle.join();
     }
@@ -160,21 +359,221 @@ public:
 
     void waitTasksDone() {
         waiting = true;
-        HipeUniqGuard lock(cv_locker);
-        task_done_cv.wait(lock, [this] { return !task_numb; });
+        task_done.wait([this] { return !task_numb; });
     }
 
     void cleanWaitingFlag() {
         waiting = false;
     }
 
+    // only touches the locker if someone is sleeping for it
     void notifyTaskDone() {
-        HipeUniqGuard lock(cv_locker);
-        task_done_cv.notify_one();
+        task_done.notifyAll();
+    }
+
+    /**
+     * Sleep until a new task arrives or wake() is called.
+     * Return immediately if there are tasks or the pond has been stopped.
+     */
+    void park(const std::atomic<bool>& stop, uint64_t timeout_ns = 0) {
+        HipeUniqGuard lock(park_locker);
+        parked.store(true);
+        if (!notask() || stop.load()) {
+            parked.store(false);
+            return;
+        }
+        HIPE_TRACE(trace.record(util::TraceKind::park));
+        if (timeout_ns) {
+            // the timed out thread is still marked as parked until it takes the locker again
+            park_cv.wait_for(lock, std::chrono::nanoseconds(timeout_ns), [this] { return !parked.load(); });
+            parked.store(false);
+        } else {
+            park_cv.wait(lock, [this] { return !parked.load(); });
+        }
+        HIPE_TRACE(trace.record(util::TraceKind::wake));
+    }
+
+    // wake up the thread if it is parked
+    void wake() {
+        if (parked.load()) {
+            HipeLockGuard lock(park_locker);
+            parked.store(false);
+            park_cv.notify_one();
+        }
+    }
+
+    /**
+     * Push a task submitted by the thread itself to the local deque, without locking or load probing.
+     * The task will be moved only if it is pushed successfully.
+     * @param capacity task capacity of the thread, zero means unlimited
+     * @return false if the capacity or the local deque is full
+     */
+    template <typename T>
+    bool tryPushLocal(T&& tar, int capacity) {
+        if (capacity) {
+            if (!tryReserve(1, capacity)) {
+                return false;
+            }
+        } else {
+            task_numb++;
+        }
+        if (!local_tq.push(std::forward<T>(tar))) {
+            task_numb--;
+            return false;
+        }
+        return true;
+    }
+
+    // run one task in the local deque, return false if it is empty
+    bool runLocalTask() {
+        HipeTask tmp;
+        if (local_tq.empty() || !local_tq.pop(tmp)) {
+            return false;
+        }
+        invokeTask(tmp);
+        taskDone();
+        return true;
+    }
+
+    // run the tasks in the local deque
+    void runLocalTasks() {
+        HipeTask tmp;
+        while (!local_tq.empty() && local_tq.pop(tmp)) {
+            invokeTask(tmp);
+            taskDone();
+        }
+    }
+
+    /**
+     * Steal about half of the tasks in another thread's local deque (the oldest first).
+     * Must be called by the thread owning this object.
+     * @return the number of stolen tasks
+     */
+    int stealLocalTasks(ThreadBase& victim) {
+        long numb = (victim.local_tq.size() + 1) / 2;
+        int stolen = 0;
+        HipeTask tmp;
+        while (stolen < numb && victim.local_tq.steal(tmp)) {
+            takeOver(victim);
+            stolen++;
+            pushLocal(std::move(tmp));
+        }
+        return stolen;
+    }
+
+protected:
+    // run a task unless the thread is dropping its tasks
+    template <typename T>
+    void invokeTask(T& task) {
+        size_t bytes = (budget && budget->enabled()) ? util::storedBytes(task) : 0;
+        if (!dropping.load(std::memory_order_relaxed)) {
+            HIPE_TRACE(trace.record(util::TraceKind::task_begin));
+            task();
+            HIPE_TRACE(trace.record(util::TraceKind::task_end));
+        } else {
+            // destroy the dropped task now, the slot it is in may be kept by the thread (its future gets broken_promise)
+            T dropped(std::move(task));
+        }
+        if (bytes) {
+            budget->release(bytes);
+        }
+    }
+
+    // count a task that has been run
+    void taskDone() {
+        idle_since = 0;
+        task_numb--;
+        if (capacity_freed) {
+            capacity_freed->notifyAll();
+        }
+        HIPE_METRICS(metrics.countExecuted());
+    }
+
+    // take over the counting of the tasks moved from the victim
+    void takeOver(ThreadBase& victim, int numb = 1) {
+        task_numb += numb;
+        victim.task_numb -= numb;
+        HIPE_METRICS(metrics.countStolen(numb); victim.metrics.countStolenFrom(numb));
+        HIPE_TRACE(trace.record(util::TraceKind::steal, numb, victim.index));
+    }
+
+    // push a counted task to the local deque, run it directly if the deque is full
+    void pushLocal(HipeTask&& tar) {
+        if (!local_tq.push(std::move(tar))) {
+            invokeTask(tar);
+            taskDone();
+        }
+    }
+
+    /**
+     * Move at most "numb" tasks from a task queue to the local deque. Must be called by the thread owning this object
+     * and the tasks moved should have been counted by "victim".
+     * @return the number of moved tasks
+     */
+    int pullToLocal(std::queue<HipeTask>& tq, int numb, ThreadBase& victim) {
+        int moved = 0;
+        while (moved < numb && !tq.empty()) {
+            if (&victim != this) {
+                takeOver(victim);
+            }
+            pushLocal(std::move(tq.front()));
+            tq.pop();
+            moved++;
+        }
+        return moved;
+    }
+
+    int pullToLocal(util::RingBuffer<HipeTask>& tq, int numb, ThreadBase& victim) {
+        int moved = 0;
+        HipeTask tmp;
+        while (moved < numb && tq.pop(tmp)) {
+            if (&victim != this) {
+                takeOver(victim);
+            }
+            pushLocal(std::move(tmp));
+            moved++;
+        }
+        return moved;
+    }
+
+    // spare slots of the local deque
+    int localSpare() {
+        return static_cast<int>(static_cast<long>(local_tq.capacity()) - local_tq.size());
     }
 };
 
 
+/**
+ * @brief Tells the pond that the task is going to block, such as on disk or network io.
+ * While the region lasts, the worker running the task hands its queued tasks over to the idle workers (whether stealing
+ * is enabled or not), and the producers pass it over when delivering new tasks. The regions can be nested. It is
+ * a no-op on the other threads, including the ones of DynamicThreadPond.
+ */
+class BlockingRegion
+{
+public:
+    BlockingRegion() {
+        util::WorkerHelper::current().enterBlocking();
+    }
+
+    ~BlockingRegion() {
+        util::WorkerHelper::current().leaveBlocking();
+    }
+
+    BlockingRegion(const BlockingRegion&) = delete;
+    BlockingRegion& operator=(const BlockingRegion&) = delete;
+};
+
+/**
+ * @brief Run a blocking call in a BlockingRegion and return what it returns.
+ */
+template <typename F>
+auto blocking(F&& foo) -> decltype(foo()) {
+    BlockingRegion region;
+    return foo();
+}
+
+
 /**
  * @brief Basic class of thread pond that has defined all mechanism except async thread's loop.
  * @tparam The type of thread wrapper class that inherited from ThreadBase.
@@ -184,13 +583,13 @@ class FixedThreadPond
 {
 protected:
     // stop the thread pend
-    bool stop = {false};
+    std::atomic<bool> stop = {false};
 
     // thread number
     int thread_numb = 0;
 
-    // cursor of the thread pond, used to travel the pond
-    int cursor = 0;
+    // number of the producers that have traveled the pond, used to spread their cursors
+    std::atomic_int producer_numb = {0};
 
     // cursor's move limit
     int cursor_move_limit = 0;
@@ -201,6 +600,16 @@ protected:
     // whether enable tasks stealing
     bool enable_steal_tasks = false;
 
+    // whether use the work-stealing scheduler (local deques, random victims and steal-half)
+    bool work_stealing = false;
+
+    // how the idle threads wait for new tasks, which can be changed while they are running
+    std::atomic<WaitStrategy> wait_strategy = {WaitStrategy::spin_yield};
+
+    // rounds an idle thread spins (and then yields, if the strategy is spin_park) before the next step
+    static constexpr int spin_limit = 64;
+    static constexpr int yield_limit = 16;
+
     // threads
     std::unique_ptr<Ttype[]> threads = {nullptr};
 
@@ -210,17 +619,63 @@ protected:
     // tasks that failed to submit
     util::Block<HipeTask> overflow_tasks{0};
 
+    // the producers waiting for capacity sleep on it, and the workers notify it when tasks are done
+    util::EventCount capacity_freed;
+
+    // bytes of the queued tasks, unlimited by default
+    util::ByteBudget byte_budget{&capacity_freed};
+
+    // the idle workers release the storage of their queues after so many nanoseconds, zero means never
+    std::atomic<uint64_t> reclaim_ns = {0};
+
+    // protect the overflow tasks from the producers that overflow at the same time
+    std::recursive_mutex overflow_locker;
+
     // task overflow call back
     HipeTask refuse_cb;
 
+    // timer wheel of the delayed and periodic tasks, created on first use
+    std::unique_ptr<util::TimerWheel> timer;
+    std::once_flag timer_flag;
+
+    // cpu and numa node of each worker, empty if the workers are not pinned
+    std::vector<int> worker_cpu;
+    std::vector<int> worker_node;
+
+    // workers of each numa node, empty if all the workers are on one node
+    std::vector<std::vector<int>> node_threads;
+
+    // next worker on the same node of each worker, used to travel the pond node by node
+    std::vector<int> node_next;
+
+    // number of the pinned workers that have allocated their queues
+    std::atomic_int placed_numb = {0};
+
+    // number of the workers blocked in a BlockingRegion
+    std::atomic_int blocked_numb = {0};
+
+#ifdef HIPE_ENABLE_METRICS
+    // number of the tasks refused
+    std::atomic<uint64_t> overflow_numb = {0};
+#endif
+
+#ifdef HIPE_ENABLE_TRACE
+    // overflow events of the producers, written under the overflow locker
+    util::TraceRing overflow_trace;
+
+    // the events before it are not dumped
+    std::atomic<uint64_t> trace_base = {0};
+#endif
+
 protected:
     /**
      * @param thread_numb fixed thread number
      * @param task_capacity task capacity of the pond, default: unlimited
+     * @param placement how to pin the workers to the cpus, default: not pinned
      * @param type_limit  Use SFINAE to restrict the type of template parameter only to be inherited from ThreadBase
      */
     explicit FixedThreadPond(
-        int thread_numb = 0, int task_capacity = HipeUnlimited,
+        int thread_numb = 0, int task_capacity = HipeUnlimited, const Placement& placement = Placement(),
         typename std::enable_if<std::is_base_of<ThreadBase, Ttype>::value>::type* type_limit = nullptr) {
 
         assert(thread_numb >= 0);
@@ -245,6 +700,51 @@ protected:
 
         // load balance
         cursor_move_limit = getBestMoveLimit(thread_numb);
+
+        // placement
+        worker_cpu = placement.cpusFor(this->thread_numb);
+        initNodes();
+    }
+
+    /**
+     * Group the pinned workers by numa node.
+     * If they are on more than one node, the load balancing and stealing prefer the workers on the same node.
+     */
+    void initNodes() {
+        if (worker_cpu.empty()) {
+            return;
+        }
+        const auto& topology = util::CpuTopology::get();
+        std::vector<std::vector<int>> groups;
+        for (int i = 0; i < thread_numb; ++i) {
+            int node = topology.nodeOf(worker_cpu[i]);
+            worker_node.push_back(node);
+            if (node >= static_cast<int>(groups.size())) {
+                groups.resize(node + 1);
+            }
+            groups[node].push_back(i);
+        }
+        int used = 0;
+        for (auto& g : groups) {
+            used += !g.empty();
+        }
+        if (used < 2) {
+            return;
+        }
+        node_threads = std::move(groups);
+        node_next.resize(thread_numb);
+        for (auto& g : node_threads) {
+            for (size_t k = 0; k < g.size(); ++k) {
+                node_next[g[k]] = g[(k + 1) % g.size()];
+            }
+        }
+    }
+
+    // wait until all the pinned workers allocated their queues, called at the end of the constructors
+    void waitForPlacement() {
+        while (!worker_cpu.empty() && placed_numb.load() < thread_numb) {
+            std::this_thread::yield();
+        }
     }
 
     virtual ~FixedThreadPond() {
@@ -263,6 +763,9 @@ public:
      * Wait until all threads finish their task
      */
     void waitForTasks() {
+        if (getLocalThread()) {
+            throw std::logic_error("[HipeError]: A task can't wait for the pond running it, wait for a TaskGroup instead");
+        }
         for (int i = 0; i < thread_numb; ++i) {
             threads[i].waitTasksDone();
         }
@@ -274,11 +777,25 @@ public:
 
     /**
      * @brief Close the pond.
-     * Notice that the tasks that are still waiting will never been executed.
-     * If you want to make sure that all tasks executed, call waitForTasks() before close.
+     * Notice that the tasks that are still waiting will never been executed by default.
+     * @param mode CloseMode::drain runs them before closing, and CloseMode::cancel_and_drain drops them
      */
-    void close() {
+    void close(CloseMode mode = CloseMode::discard) {
+        if (timer) {
+            timer->close();
+        }
+        if (mode == CloseMode::cancel_and_drain) {
+            for (int i = 0; i < thread_numb; ++i) {
+                threads[i].dropTasks();
+            }
+        }
+        if (mode != CloseMode::discard) {
+            waitForTasks();
+        }
         stop = true;
+        for (int i = 0; i < thread_numb; ++i) {
+            threads[i].wake();
+        }
         for (int i = 0; i < thread_numb; ++i) {
             threads[i].join();
         }
@@ -303,18 +820,142 @@ public:
         return thread_numb;
     }
 
+    // whether the calling thread is a worker of the pond
+    bool isInPond() {
+        return getLocalThread() != nullptr;
+    }
+
+#ifdef HIPE_ENABLE_METRICS
+    /**
+     * @brief take a snapshot of the metrics, only available if HIPE_ENABLE_METRICS is defined
+     * The workers keep running while their counters are read, so the counters of a snapshot may be a little
+     * inconsistent with each other. The counters only grow, take the difference of two snapshots for a period.
+     */
+    PondMetrics getMetrics() {
+        PondMetrics ret;
+        ret.workers.resize(thread_numb);
+        for (int i = 0; i < thread_numb; ++i) {
+            threads[i].metrics.load(ret.workers[i]);
+        }
+        ret.overflow = overflow_numb.load(std::memory_order_relaxed);
+        return ret;
+    }
+#endif
+
+#ifdef HIPE_ENABLE_TRACE
+    /**
+     * @brief start recording the timeline, only available if HIPE_ENABLE_TRACE is defined
+     * Each worker keeps its latest HIPE_TRACE_BUFFER_SIZE events: task begin/end, steal, park/wake and the number of
+     * tasks it loads, and the refused tasks are recorded as overflow events. The events before the start are dropped.
+     */
+    void startTrace() {
+        trace_base.store(util::nowNanos());
+        for (int i = 0; i < thread_numb; ++i) {
+            threads[i].trace.enable(true);
+        }
+        overflow_trace.enable(true);
+    }
+
+    void stopTrace() {
+        for (int i = 0; i < thread_numb; ++i) {
+            threads[i].trace.enable(false);
+        }
+        overflow_trace.enable(false);
+    }
+
+    /**
+     * @brief write the timeline as Chrome trace JSON, which can be opened by chrome://tracing or Perfetto
+     * Stop the tracing first for an exact capture, a few latest events may be torn if the workers are still writing.
+     */
+    void writeTrace(std::ostream& os) {
+        uint64_t base = trace_base.load();
+        os << "{\"traceEvents\":[\n{\"pid\":1,\"ph\":\"M\",\"name\":\"process_name\",\"args\":{\"name\":\"hipe\"}}";
+        for (int i = 0; i < thread_numb; ++i) {
+            util::writeTraceName(os, i, "worker", i);
+            threads[i].trace.write(os, i, base);
+        }
+        util::writeTraceName(os, thread_numb, "producers");
+        {
+            std::lock_guard<std::recursive_mutex> lock(overflow_locker);
+            overflow_trace.write(os, thread_numb, base);
+        }
+        os << "\n]}\n";
+    }
+
+    // write the timeline to a file
+    void dumpTrace(const std::string& path) {
+        std::ofstream os(path);
+        if (!os) {
+            throw std::runtime_error("[HipeError]: Can't open the trace file " + path);
+        }
+        writeTrace(os);
+    }
+#endif
+
     /**
      * @brief submit task
+     * Different threads can submit tasks at the same time.
      * @param foo a runable object
      */
     template <typename F>
     void submit(F&& foo) {
-        if (!admit()) {
+        if (!post(std::forward<F>(foo))) {
             taskOverFlow(std::forward<F>(foo));
+        }
+    }
+
+    /**
+     * @brief submit task with a cancellation token
+     * The task is skipped if the token has been cancelled when a worker reaches it.
+     */
+    template <typename F>
+    void submit(F&& foo, const CancellationToken& token) {
+        submit(withToken(token, std::forward<F>(foo)));
+    }
+
+    /**
+     * @brief try to submit task without overflowing
+     * @param foo a runable object, which is not moved if the pond is full
+     * @return false if the pond is full
+     */
+    template <typename F>
+    bool trySubmit(F&& foo) {
+        return post(std::forward<F>(foo));
+    }
+
+    /**
+     * @brief submit task, wait for capacity if the pond is full
+     * The producer sleeps until a worker finishes a task, instead of overflowing.
+     * Don't call it in a task of the same pond, or all the workers may wait for each other.
+     * @param foo a runable object
+     */
+    template <typename F>
+    void submitBlocking(F&& foo) {
+        if (post(std::forward<F>(foo))) {
             return;
         }
-        auto t = getLeastBusyThread();
-        t->enqueue(std::forward<F>(foo));
+        size_t bytes = taskBytes(foo);
+        capacity_freed.wait([this, bytes] { return admitTask(bytes); });
+        deliver(std::forward<F>(foo));
+    }
+
+    /**
+     * @brief submit task, wait for capacity for a while if the pond is full
+     * @param timeout the longest time to wait
+     * @param foo a runable object, which is not moved if it fails
+     * @return false if there is still no capacity after the timeout
+     */
+    template <typename Rep, typename Period, typename F>
+    bool submitFor(const std::chrono::duration<Rep, Period>& timeout, F&& foo) {
+        if (post(std::forward<F>(foo))) {
+            return true;
+        }
+        size_t bytes = taskBytes(foo);
+        if (!capacity_freed.waitFor(timeout, [this, bytes] { return admitTask(bytes); })) {
+            return false;
+        }
+        deliver(std::forward<F>(foo));
+        return true;
     }
 
     /**
@@ -323,43 +964,144 @@ public:
      * @return a future
      */
     template <typename F>
-    auto submitForReturn(F&& foo) -> std::future<typename std::result_of<F()>::type> {
-        if (!admit()) {
-            taskOverFlow(std::forward<F>(foo));
-            return std::future<typename std::result_of<F()>::type>();
-        }
-
+    auto submitForReturn(F&& foo) -> Future<typename std::result_of<F()>::type> {
         using RT = typename std::result_of<F()>::type;
-        std::packaged_task<RT()> pack(std::forward<F>(foo));
-        std::future<RT> fut(pack.get_future());
+        Future<RT> fut;
+        auto task = util::packTask(std::forward<F>(foo), fut);
 
-        auto t = getLeastBusyThread();
-        t->enqueue(std::move(pack));
+        if (!post(std::move(task))) {
+            taskOverFlow(std::move(task));
+            return Future<RT>();
+        }
         return fut;
     }
 
 
     /**
      * submit in a batch and the task container must override "[]"
+     * The batch is split into contiguous slices in proportion to the spare capacity of each thread (an unlimited
+     * pond fills the threads up to an even level), each slice is reserved at once and pushed with one lock.
      * @param cont tasks container
      * @param size the size of the container
      */
     template <typename Container_>
     void submitInBatch(Container_&& container, size_t size) {
-        if (thread_cap) {
-            moveCursorToLeastBusy();
-            for (size_t i = 0; i < size; ++i) {
-                // admit one task
-                if (admit()) {
-                    getThreadNow()->enqueue(std::move(container[i]));
-                } else {
-                    taskOverFlow(std::forward<Container_>(container), i, size);
-                    break;
-                }
+        size_t done = trySubmitInBatch(container, size);
+        if (done < size) {
+            taskOverFlow(std::forward<Container_>(container), static_cast<int>(done), static_cast<int>(size));
+        }
+    }
+
+    /**
+     * submit in a batch as submitInBatch(), but leave the tasks that can't be held instead of refusing them
+     * @return the number of tasks submitted, they are the first ones of the container
+     */
+    template <typename Container_>
+    size_t trySubmitInBatch(Container_& container, size_t size) {
+        if (!byte_budget.enabled()) {
+            return deliverBatch(container, size);
+        }
+        // the tasks beyond the budget are left
+        size_t allowed = 0;
+        while (allowed < size && byte_budget.tryAcquire(Ttype::bytesOf(container[allowed]))) {
+            allowed++;
+        }
+        size_t done = deliverBatch(container, allowed);
+        for (size_t i = done; i < allowed; ++i) {
+            byte_budget.release(Ttype::bytesOf(container[i]));
+        }
+        return done;
+    }
+
+private:
+    template <typename Container_>
+    size_t deliverBatch(Container_& container, size_t size) {
+        if (!size) {
+            return 0;
+        }
+        // start from the thread next to the cursor, so that the small batches go to different threads
+        int& cursor = getCursor();
+        int start = cursor;
+        util::recyclePlus(cursor, 0, thread_numb);
+
+        std::vector<int> spare(thread_numb);
+        int limit = thread_cap;
+        if (!limit) {
+            int max_load = 0;
+            for (int i = 0; i < thread_numb; ++i) {
+                spare[i] = threads[i].getTasksNumb();
+                max_load = std::max(max_load, spare[i]);
+            }
+            limit = max_load + static_cast<int>((size + thread_numb - 1) / thread_numb);
+            for (int i = 0; i < thread_numb; ++i) {
+                spare[i] = limit - spare[i];
             }
         } else {
-            getLeastBusyThread()->enqueue(std::forward<Container_>(container), size);
+            for (int i = 0; i < thread_numb; ++i) {
+                spare[i] = std::max(0, limit - threads[i].getTasksNumb());
+            }
+        }
+        unsigned long long total = 0;
+        for (auto n : spare) {
+            total += static_cast<unsigned long long>(n);
+        }
+
+        // the deficit of a thread that failed to reserve its whole slice goes to the next one
+        size_t done = 0;
+        unsigned long long acc = 0;
+        for (int k = 0; k < thread_numb && done < size; ++k) {
+            int i = (start + k) % thread_numb;
+            acc += static_cast<unsigned long long>(spare[i]);
+            size_t goal = (size >= total) ? static_cast<size_t>(acc) : static_cast<size_t>(size * acc / total);
+            if (k == thread_numb - 1 && !thread_cap) {
+                goal = size;
+            }
+            if (goal > done) {
+                done += deliverSlice(threads[i], container, done, std::min(goal, size));
+            }
         }
+        // the threads may have been filled by the others, try once more before refusing the tasks
+        for (int k = 0; k < thread_numb && done < size; ++k) {
+            done += deliverSlice(threads[(start + k) % thread_numb], container, done, size);
+        }
+        return done;
+    }
+
+public:
+    /**
+     * @brief (C++20) resume the coroutine on a worker of the pond: co_await pond.schedule();
+     * The coroutine handle is submitted as a small task, waiting for capacity if the pond is full (a worker of the pond
+     * keeps running the coroutine instead).
+     */
+    util::ScheduleAwaiter<FixedThreadPond> schedule() {
+        return util::ScheduleAwaiter<FixedThreadPond>(*this);
+    }
+
+    /**
+     * @brief submit task after a delay
+     * The timers of the pond share one timing wheel, the expired tasks are submitted in batches. If the pond is full,
+     * the tasks are delayed until it has room instead of overflowing.
+     * @param delay the time to wait
+     * @param foo a runnable object
+     * @return a handle to cancel the task before it expires
+     */
+    template <typename Rep, typename Period, typename F>
+    TimerHandle submitAfter(const std::chrono::duration<Rep, Period>& delay, F&& foo) {
+        auto d = std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+        return TimerHandle(getTimer().add(d, std::chrono::steady_clock::duration::zero(), std::forward<F>(foo)));
+    }
+
+    /**
+     * @brief submit task every period
+     * The task runs first after one period, and the next period starts after the last run finished.
+     * @param period the period
+     * @param foo a runnable object
+     * @return a handle to stop the task
+     */
+    template <typename Rep, typename Period, typename F>
+    TimerHandle submitEvery(const std::chrono::duration<Rep, Period>& period, F&& foo) {
+        auto d = std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        return TimerHandle(getTimer().add(d, d, std::forward<F>(foo)));
     }
 
 
@@ -368,6 +1110,15 @@ protected:
     //              load balancing mechanism
     // ====================================================
 
+    // get the timer wheel, which hands the expired tasks to the pond in batches (the ones a full pond can't hold are
+    // handed over again on the next tick, rather than overflowing on the timer thread)
+    util::TimerWheel& getTimer() {
+        std::call_once(timer_flag, [this] {
+            timer.reset(new util::TimerWheel([this](std::vector<HipeTask>& tasks) { trySubmitInBatch(tasks, tasks.size()); }));
+        });
+        return *timer;
+    }
+
 
     /**
      * Move cursor to the least busy thread and then get
@@ -375,25 +1126,140 @@ protected:
      */
     Ttype* getLeastBusyThread() {
         moveCursorToLeastBusy();
-        return &threads[cursor];
+        return &threads[getCursor()];
+    }
+
+    /**
+     * Get the cursor of the calling thread.
+     * Every producer travels the pond with its own cursor, so that many threads can submit tasks at the same time.
+     */
+    int& getCursor() {
+        static thread_local int cursor = -1;
+        if (cursor < 0 || cursor >= thread_numb) {
+            unsigned k = static_cast<unsigned>(producer_numb++);
+            cursor = static_cast<int>(k % static_cast<unsigned>(thread_numb));
+
+            // start from a worker on the node of the producer
+            int node = node_threads.empty() ? -1 : util::CpuTopology::get().currentNode();
+            if (node >= 0 && node < static_cast<int>(node_threads.size()) && !node_threads[node].empty()) {
+                cursor = node_threads[node][k % node_threads[node].size()];
+            }
+        }
+        return cursor;
     }
 
     /**
      * Move cursor to the least busy thread.
      * If the thread that pointed by the cursor has been the least busy one then the cursor will not move.
+     * The pinned workers on more than one numa node are traveled within the node of the cursor.
      */
     void moveCursorToLeastBusy() {
+        int& cursor = getCursor();
         int tmp = cursor;
         for (int i = 0; i < cursor_move_limit; ++i) {
-            if (threads[cursor].getTasksNumb()) {
-                cursor = (threads[tmp].getTasksNumb() < threads[cursor].getTasksNumb()) ? tmp : cursor;
-                util::recyclePlus(tmp, 0, thread_numb);
+            if (getLoad(cursor)) {
+                cursor = (getLoad(tmp) < getLoad(cursor)) ? tmp : cursor;
+                if (node_next.empty()) {
+                    util::recyclePlus(tmp, 0, thread_numb);
+                } else {
+                    tmp = node_next[tmp];
+                }
             } else {
                 break;
             }
         }
     }
 
+    // task number of a thread, the threads blocked in a BlockingRegion are taken as the busiest ones
+    int getLoad(int i) {
+        if (blocked_numb.load(std::memory_order_relaxed) && threads[i].isBlocking()) {
+            return std::numeric_limits<int>::max();
+        }
+        return threads[i].getTasksNumb();
+    }
+
+    /**
+     * Take over the queued tasks of a worker blocked in a BlockingRegion, called by an idle worker.
+     * @return false if there is no blocked worker or it has no task to give
+     */
+    bool takeBlockedTasks(Ttype& self) {
+        if (!blocked_numb.load(std::memory_order_relaxed)) {
+            return false;
+        }
+        for (int i = 0; i < thread_numb; ++i) {
+            if (i != self.getIndex() && threads[i].isBlocking() && threads[i].tryGiveHalfTasks(self)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Pick a thread except "self" at random.
+     * The pinned workers on more than one numa node pick the ones on the same node in the first half of the rounds.
+     * @param round how many victims have been tried
+     */
+    int getRandomVictim(Ttype& self, int round = 0) {
+        if (!node_threads.empty() && round <= max_steal / 2) {
+            auto& group = node_threads[worker_node[self.getIndex()]];
+            if (group.size() > 1) {
+                size_t k = util::xorshift(self.seed) % static_cast<uint32_t>(group.size() - 1);
+                return (group[k] == self.getIndex()) ? group.back() : group[k];
+            }
+        }
+        int i = static_cast<int>(util::xorshift(self.seed) % static_cast<uint32_t>(thread_numb - 1));
+        return (i >= self.getIndex()) ? i + 1 : i;
+    }
+
+    /**
+     * Wait for new tasks according to the wait strategy.
+     * @param rounds idle rounds of the thread, which should be reset after running tasks
+     */
+    void idleWait(Ttype& self, int& rounds) {
+        uint64_t timeout = 0;
+        if (uint64_t idle = reclaim_ns.load(std::memory_order_relaxed)) {
+            timeout = self.reclaimCountdown(idle);
+            if (!timeout) {
+                self.shrinkStorage();
+                util::trimHeap();
+            }
+            // park until it is time to reclaim
+            timeout = (timeout == UINT64_MAX) ? 0 : timeout;
+        }
+        switch (wait_strategy.load(std::memory_order_relaxed)) {
+        case WaitStrategy::busy_spin:
+            HIPE_PAUSE();
+            break;
+        case WaitStrategy::spin_yield:
+            if (rounds < spin_limit) {
+                rounds++;
+                HIPE_PAUSE();
+            } else {
+                std::this_thread::yield();
+            }
+            break;
+        case WaitStrategy::spin_park:
+            if (rounds < spin_limit) {
+                rounds++;
+                HIPE_PAUSE();
+            } else if (rounds < spin_limit + yield_limit) {
+                rounds++;
+                std::this_thread::yield();
+            } else {
+                self.park(stop, timeout);
+                rounds = 0;
+            }
+            break;
+        }
+    }
+
+    // wake up a parked thread at random, so that it can come to steal tasks from the busy one
+    void wakeThief(Ttype& self) {
+        if (enable_steal_tasks && wait_strategy.load(std::memory_order_relaxed) == WaitStrategy::spin_park && thread_numb > 1) {
+            threads[getRandomVictim(self)].wake();
+        }
+    }
+
     // calculate best cursor move limit
     int getBestMoveLimit(int thread_number) {
         if (thread_number == 1) {
@@ -421,11 +1287,69 @@ public:
         enable_steal_tasks = true;
     }
 
+    /**
+     * @brief enable the work-stealing scheduler
+     * Every thread runs its tasks through a lock-free local deque (LIFO), and an idle thread picks its victims at
+     * random and takes about half of the victim's tasks (FIFO) each time.
+     * @param max_numb max number of victims an idle thread tries before yielding
+     */
+    void enableWorkStealing(int max_numb = 0) {
+        enableStealTasks(max_numb);
+        work_stealing = true;
+    }
+
     // disable task stealing between each thread
     void disableStealTasks() {
         enable_steal_tasks = false;
+        work_stealing = false;
+    }
+
+
+public:
+    /**
+     * @brief limit the memory taken by the queued tasks
+     * A task counts the task object and the heap block of a large callable object, but not the memory the callable
+     * object points to (such as the buffer of a captured vector). The tasks beyond the budget overflow like the ones
+     * beyond the capacity, and submitBlocking() waits for the budget as well.
+     * Set it while the pond is idle, the tasks queued before are not counted.
+     * @param bytes the budget, zero means unlimited (default)
+     */
+    void setByteBudget(size_t bytes) {
+        byte_budget.setLimit(bytes);
+    }
+
+    // get the bytes of the queued tasks, zero if the budget is unlimited
+    size_t getQueuedBytes() const {
+        return byte_budget.getUsed();
+    }
+
+    /**
+     * @brief let the idle workers release the storage of their queues
+     * A worker idle for the period frees the memory its queues kept for a past spike, and returns the free heap to the
+     * system where the allocator supports it (glibc's malloc_trim).
+     * @param idle the period, zero to keep the storage (default)
+     */
+    template <typename Rep, typename Period>
+    void setIdleReclaim(const std::chrono::duration<Rep, Period>& idle) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(idle).count();
+        reclaim_ns.store(static_cast<uint64_t>(std::max<decltype(ns)>(0, ns)));
+        for (int i = 0; i < thread_numb; ++i) {
+            threads[i].wake();
+        }
     }
 
+    /**
+     * @brief set how the idle threads wait for new tasks
+     * Use WaitStrategy::spin_park if the cpu cost of an idle pond matters more than the latency of waking up.
+     */
+    void setWaitStrategy(WaitStrategy strategy) {
+        wait_strategy.store(strategy, std::memory_order_relaxed);
+        if (strategy != WaitStrategy::spin_park) {
+            for (int i = 0; i < thread_numb; ++i) {
+                threads[i].wake();
+            }
+        }
+    }
 
 public:
     // ====================================================
@@ -435,13 +1359,13 @@ public:
 
     /**
      * Set refuse call back.
-     * If the capacity is unlimited , the hipe will throw a logic error.
+     * If the capacity and the byte budget are unlimited , the hipe will throw a logic error.
      * If didn't set and refuse call back, the hipe will throw logic error and abort the program.
      */
     template <typename F, typename... Args>
     void setRefuseCallBack(F&& foo, Args&&... args) {
         static_assert(util::is_runnable<F, Args...>::value, "[HipeError]: The refuse callback is a non-runnable object");
-        if (!thread_cap) {
+        if (!thread_cap && !byte_budget.enabled()) {
             throw std::logic_error(
                 "[HipeError]: The refuse callback will never be invoked because the capacity has been set unlimited");
         } else {
@@ -454,19 +1378,20 @@ public:
      * Then the new tasks will replace the old.
      */
     util::Block<HipeTask> pullOverFlowTasks() {
+        std::lock_guard<std::recursive_mutex> lock(overflow_locker);
         auto tmp = std::move(overflow_tasks);
         return tmp;
     }
 
 protected:
     Ttype* getThreadNow() {
-        return &threads[cursor];
+        return &threads[getCursor()];
     }
 
 
     /**
-     * Judge whether there are enough capacity for tasks,
-     * if the task capacity of the pond is unlimited, it will always return true.
+     * Judge whether there are enough capacity for tasks and reserve it in the thread pointed by the cursor.
+     * If the task capacity of the pond is unlimited, it will always return true.
      * This function will possibly move the cursor of the thread pond for enough capacity.
      * @param tar_capacity target capacity
      */
@@ -474,9 +1399,10 @@ protected:
         if (!thread_cap) {
             return true;
         }
+        moveCursorToLeastBusy();
+        int& cursor = getCursor();
         int prev = cursor;
-        auto spare = [this, tar_capacity](Ttype& t) { return (t.getTasksNumb() + tar_capacity) <= thread_cap; };
-        while (!spare(threads[cursor])) {
+        while (!threads[cursor].tryReserve(tar_capacity, thread_cap)) {
             util::recyclePlus(cursor, 0, thread_numb);
             if (cursor == prev)
                 return false;
@@ -484,12 +1410,173 @@ protected:
         return true;
     }
 
+    /**
+     * Deliver a task to the pond.
+     * Tasks submitted by a worker of the pond are pushed to its local deque directly, and the stealing mechanism will
+     * rebalance them.
+     * @return false if the pond is full, and the task will not be moved
+     */
+    template <typename T>
+    bool post(T&& task) {
+        size_t bytes = taskBytes(task);
+        if (!byte_budget.tryAcquire(bytes)) {
+            return false;
+        }
+        Ttype* self = getLocalThread();
+        if (self && self->tryPushLocal(std::forward<T>(task), thread_cap)) {
+            wakeThief(*self);
+            return true;
+        }
+        if (!admit()) {
+            byte_budget.release(bytes);
+            return false;
+        }
+        deliver(std::forward<T>(task));
+        return true;
+    }
+
+    // bytes of a task in the queues of the threads, zero if the budget is unlimited
+    template <typename T>
+    size_t taskBytes(const T& task) {
+        return byte_budget.enabled() ? Ttype::bytesOf(task) : 0;
+    }
+
+    // reserve the bytes and the capacity of a task
+    bool admitTask(size_t bytes) {
+        if (!byte_budget.tryAcquire(bytes)) {
+            return false;
+        }
+        if (!admit()) {
+            byte_budget.release(bytes);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Run a task for a worker waiting in a task (see util::WorkerHelper), from its local deque, then its queues that
+     * have not been loaded, then the queues of another worker. The batch being run by the worker is not touched, and
+     * the local deque goes first so that the tasks nested in tasks get helped first.
+     */
+    static bool helpWorker(void* arg) {
+        Ttype& self = *static_cast<Ttype*>(arg);
+        auto pond = static_cast<FixedThreadPond*>(const_cast<void*>(self.getOwner()));
+        if (self.runLocalTask() || self.runUnloadedTask()) {
+            return true;
+        }
+        if (pond->stop.load() || pond->thread_numb < 2) {
+            return false;
+        }
+        return self.helpFrom(pond->threads[pond->getRandomVictim(self)]);
+    }
+
+    /**
+     * Called by a worker entering or leaving a BlockingRegion (see util::WorkerHelper).
+     * The worker puts back the tasks it has loaded and wakes up the parked workers to take over its queued tasks.
+     */
+    static void blockWorker(void* arg, bool blocking) {
+        Ttype& self = *static_cast<Ttype*>(arg);
+        auto pond = static_cast<FixedThreadPond*>(const_cast<void*>(self.getOwner()));
+        if (!blocking) {
+            self.setBlocking(false);
+            pond->blocked_numb--;
+            return;
+        }
+        self.shedLoadedTasks();
+        self.setBlocking(true);
+        pond->blocked_numb++;
+        // the running task is counted as well
+        if (self.getTasksNumb() > 1) {
+            for (int i = 0; i < pond->thread_numb; ++i) {
+                if (i != self.getIndex()) {
+                    pond->threads[i].wake();
+                }
+            }
+        }
+    }
+
+    // get the calling worker thread if it belongs to this pond, or return nullptr
+    Ttype* getLocalThread() {
+        ThreadBase* t = ThreadBase::current();
+        return (t && t->getOwner() == this) ? static_cast<Ttype*>(t) : nullptr;
+    }
+
+    /**
+     * Called by the worker thread when it starts running.
+     * A pinned worker allocates its local deque and ring buffer after pinning (the memory is allocated on the node
+     * of the thread that touches it first), and then waits for the others so that no one visits the queues being
+     * allocated. The unlimited task queues are grown by the producers instead.
+     */
+    void enterWorker(Ttype& self, int index) {
+        self.enter(this, index);
+        util::WorkerHelper::current().set(&FixedThreadPond::helpWorker, &self, &FixedThreadPond::blockWorker);
+        self.setBudget(&byte_budget);
+        if (thread_cap) {
+            self.setCapacitySignal(&capacity_freed);
+        }
+        if (worker_cpu.empty()) {
+            return;
+        }
+        util::bindThisThread(worker_cpu[index]);
+        self.placeLocal();
+        if (thread_cap) {
+            self.reserve(thread_cap);
+        }
+        placed_numb++;
+        while (placed_numb.load() < thread_numb) {
+            std::this_thread::yield();
+        }
+    }
+
+    // deliver an admitted task to the pond, a few of them are timed if the metrics are enabled
+    template <typename T>
+    void deliver(T&& task) {
+#ifdef HIPE_ENABLE_METRICS
+        // the wrapped task would take other bytes than the budget counted
+        if (util::sampleTask() && !byte_budget.enabled()) {
+            deliverTask(HipeTask(util::TimedTask<typename std::decay<T>::type>(std::forward<T>(task))));
+            return;
+        }
+#endif
+        deliverTask(std::forward<T>(task));
+    }
+
+    template <typename T>
+    void deliverTask(T&& task) {
+        if (thread_cap) {
+            getThreadNow()->push(std::forward<T>(task));
+        } else {
+            getLeastBusyThread()->enqueue(std::forward<T>(task));
+        }
+    }
+
+
+    /**
+     * Deliver the tasks in [begin, end) of the container to a thread, reserving the capacity for them at once.
+     * @return the number of tasks delivered, which may be less than requested if the capacity is limited
+     */
+    template <typename Container_>
+    size_t deliverSlice(Ttype& t, Container_& container, size_t begin, size_t end) {
+        int numb = static_cast<int>(end - begin);
+        if (thread_cap) {
+            numb = t.reserveUpTo(numb, thread_cap);
+            if (numb) {
+                t.pushBatch(container, begin, begin + numb);
+            }
+        } else {
+            t.enqueue(container, begin, end);
+        }
+        return static_cast<size_t>(numb);
+    }
 
     // task overflow callback for one task
     template <typename T>
     void taskOverFlow(T&& task) {
+        std::lock_guard<std::recursive_mutex> lock(overflow_locker);
         overflow_tasks.reset(1);
         overflow_tasks.add(std::forward<T>(task));
+        HIPE_METRICS(overflow_numb++);
+        HIPE_TRACE(overflow_trace.record(util::TraceKind::overflow, 1));
 
         if (refuse_cb.is_set()) {
             util::invoke(refuse_cb);
@@ -506,11 +1593,14 @@ protected:
      */
     template <typename T>
     void taskOverFlow(T&& tasks, int left, int right) {
+        std::lock_guard<std::recursive_mutex> lock(overflow_locker);
         overflow_tasks.reset(right - left);
 
         for (int i = left; i < right; ++i) {
             overflow_tasks.add(std::move(tasks[i]));
         }
+        HIPE_METRICS(overflow_numb += static_cast<uint64_t>(right - left));
+        HIPE_TRACE(overflow_trace.record(util::TraceKind::overflow, right - left));
         if (refuse_cb.is_set()) {
             util::invoke(refuse_cb);
         } else {
@@ -25,3 +25,55 @@
  * execution, thread load balancing.
  */
 #include "./balanced_pond.h"
+
+
+/**
+ * @brief A typed thread pond
+ * A fixed thread pond for the tasks of one type, which are kept by value and called directly without the task wrapper.
+ */
+#include "./typed_pond.h"
+
+
+/**
+ * @brief A hybrid thread pond
+ * A steady pond for the usual load, the tasks beyond its capacity spill over to an auto-scaling dynamic pond.
+ */
+#include "./hybrid_pond.h"
+
+
+/**
+ * @brief Parallel algorithms
+ * parallel_for, parallel_reduce and parallel_transform split a range into contiguous chunks and run them with any
+ * of the ponds above, together with the calling thread.
+ */
+#include "./parallel.h"
+
+
+/**
+ * @brief Task graph
+ * A graph of tasks with dependencies, each task is submitted to the pond once all its predecessors are done.
+ * The futures returned by submitForReturn can also be chained with then().
+ */
+#include "./graph.h"
+
+
+/**
+ * @brief Task group
+ * Tasks submitted through a group can be waited for by the group, without waiting for the whole pond.
+ */
+#include "./group.h"
+
+
+/**
+ * @brief Completion queue
+ * The tasks submitted through a completion queue move their results into it, which are popped in the order they finish.
+ */
+#include "./completion.h"
+
+
+/**
+ * @brief Coroutines (C++20)
+ * co_await pond.schedule() resumes a coroutine on a worker of the pond, and hipe::task<T> is a lazy coroutine whose
+ * completion resumes the awaiting one. Nothing is provided for the older standards.
+ */
+#include "./coroutine.h"
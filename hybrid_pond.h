@@ -0,0 +1,121 @@
+#pragma once
+#include "./dynamic_pond.h"
+#include "./steady_pond.h"
+
+namespace hipe {
+
+/**
+ * @brief A steady pond for the usual load with a dynamic pond for the bursts.
+ * The tasks go to the fixed threads while they have spare capacity, and the ones that can't be held spill over to an
+ * auto-scaling dynamic pond, which grows for a burst and shrinks back to no thread after it. A refused batch is moved
+ * to the dynamic pond directly, tasks are never copied through the overflow buffer or thrown as overflow.
+ */
+class HybridThreadPond
+{
+    SteadyThreadPond fixed;
+    DynamicThreadPond spill;
+
+    // number of the tasks that have spilled over
+    std::atomic<uint64_t> spilled = {0};
+
+public:
+    // the dynamic pond keeps no thread without a burst by default
+    static AutoScaleOptions defaultSpillOptions() {
+        AutoScaleOptions options;
+        options.min_threads = 0;
+        return options;
+    }
+
+    /**
+     * @param thread_numb thread number of the steady pond
+     * @param task_capacity task capacity of the steady pond, which must be limited, the tasks beyond it spill over
+     * @param spill_options how the dynamic pond scales, default: 0 ~ 4 times of the cpu number
+     * @param placement pin the fixed threads by an AffinityPolicy or a cpu list, default: not pinned
+     */
+    explicit HybridThreadPond(int thread_numb = 0, int task_capacity = 1024,
+                              const AutoScaleOptions& spill_options = defaultSpillOptions(),
+                              const Placement& placement = Placement())
+      : fixed(thread_numb, task_capacity, placement)
+      , spill(spill_options.min_threads) {
+        assert(task_capacity > 0);
+        spill.enableAutoScaling(spill_options);
+    }
+
+    ~HybridThreadPond() = default;
+
+    void close(CloseMode mode = CloseMode::discard) {
+        // the tasks left in the steady pond may still spill over
+        fixed.close(mode);
+        spill.close(mode);
+    }
+
+    /**
+     * @brief submit task
+     * @param foo a runnable object
+     */
+    template <typename F>
+    void submit(F&& foo) {
+        // the task is not moved if the steady pond refuses it
+        if (!fixed.trySubmit(std::forward<F>(foo))) {
+            spilled++;
+            spill.submit(std::forward<F>(foo));
+        }
+    }
+
+    /**
+     * @brief submit task and get the return of the task
+     * @param foo a runnable object
+     * @return a future
+     */
+    template <typename F>
+    auto submitForReturn(F&& foo) -> Future<typename std::result_of<F()>::type> {
+        using RT = typename std::result_of<F()>::type;
+        Future<RT> fut;
+        submit(util::packTask(std::forward<F>(foo), fut));
+        return fut;
+    }
+
+    /**
+     * submit in a batch and the task container must override "[]"
+     * The steady pond takes as many tasks as it can hold and the rest spill over together.
+     * @param cont tasks container
+     * @param size the size of the container
+     */
+    template <typename Container_>
+    void submitInBatch(Container_& cont, size_t size) {
+        size_t done = fixed.trySubmitInBatch(cont, size);
+        if (done < size) {
+            spilled += static_cast<uint64_t>(size - done);
+            spill.submitInBatch(cont, done, size);
+        }
+    }
+
+    // wait for the tasks of both ponds done, including the ones they submit to each other
+    void waitForTasks() {
+        do {
+            fixed.waitForTasks();
+            spill.waitForTasks();
+        } while (fixed.getTasksRemain() || spill.getTasksRemain());
+    }
+
+    int getTasksRemain() {
+        return fixed.getTasksRemain() + spill.getTasksRemain();
+    }
+
+    // the number of the tasks that have spilled over to the dynamic pond
+    uint64_t getSpilledNumb() const {
+        return spilled.load();
+    }
+
+    // the steady pond, for the stealing settings, waiting strategies and metrics
+    SteadyThreadPond& getFixedPond() {
+        return fixed;
+    }
+
+    // the dynamic pond, for its thread number
+    DynamicThreadPond& getSpillPond() {
+        return spill;
+    }
+};
+
+} // namespace hipe
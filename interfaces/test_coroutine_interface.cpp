@@ -0,0 +1,69 @@
+#include "../hipe.h"
+
+using namespace hipe;
+
+util::SyncStream stream;
+
+#ifdef HIPE_HAS_COROUTINE
+
+task<int> read_value(SteadyThreadPond& pond, int i) {
+    // continue on a worker of the pond
+    co_await pond.schedule();
+    stream.print("read value ", i, " on a worker");
+    co_return i * 10;
+}
+
+task<int> sum_values(SteadyThreadPond& pond, int n) {
+    int sum = 0;
+    for (int i = 0; i < n; ++i) {
+        // resumed by read_value when it finishes, no thread is blocked
+        sum += co_await read_value(pond, i);
+    }
+    co_return sum;
+}
+
+task<> may_throw(DynamicThreadPond& pond) {
+    co_await pond.schedule();
+    throw std::runtime_error("failed on the dynamic pond");
+}
+
+void test_schedule(SteadyThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 13), util::strong("schedule"), util::boundary('=', 16));
+
+    // wait for the coroutine outside coroutines
+    stream.print("sum: ", syncWait(sum_values(pond, 4))); // 60
+}
+
+void test_exception(DynamicThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 12), util::strong("exception"), util::boundary('=', 16));
+
+    // the exception is rethrown by co_await or syncWait
+    try {
+        syncWait(may_throw(pond));
+    } catch (const std::exception& e) {
+        stream.print("caught: ", e.what());
+    }
+}
+
+int main() {
+    stream.print(util::title("Test coroutines", 10));
+
+    SteadyThreadPond steady_pond(4);
+    DynamicThreadPond dynamic_pond(4);
+
+    test_schedule(steady_pond);
+    util::sleep_for_seconds(1);
+
+    test_exception(dynamic_pond);
+    util::sleep_for_seconds(1);
+
+    stream.print("\n", util::title("End of the test", 5));
+}
+
+#else
+
+int main() {
+    stream.print("The coroutines need C++20, please compile with -std=c++20");
+}
+
+#endif
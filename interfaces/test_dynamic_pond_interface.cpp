@@ -65,6 +65,92 @@ void test_submit_in_batch(DynamicThreadPond& pond) {
     pond.waitForTasks();
 }
 
+void test_submit_timer(DynamicThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 11), util::strong("delayed tasks"), util::boundary('=', 13));
+
+    // run once after 10 milliseconds
+    pond.submitAfter(std::chrono::milliseconds(10), [] { stream.print("delayed task"); });
+
+    // cancel it before expiring
+    auto timeout = pond.submitAfter(std::chrono::seconds(1), [] { stream.print("never run"); });
+    timeout.cancel();
+
+    // run every 10 milliseconds until cancelled
+    auto ticker = pond.submitEvery(std::chrono::milliseconds(10), [] { stream.print("periodic task"); });
+    util::sleep_for_milli(35);
+    ticker.cancel();
+
+    pond.waitForTasks();
+}
+
+void test_auto_scaling() {
+    stream.print("\n", util::boundary('=', 12), util::strong("auto scaling"), util::boundary('=', 13));
+
+    DynamicThreadPond pond(1);
+
+    // keep 1 ~ 8 threads, grow for the bursts and shrink after being idle for a while
+    AutoScaleOptions options;
+    options.min_threads = 1;
+    options.max_threads = 8;
+    pond.enableAutoScaling(options);
+
+    // a burst of blocking tasks
+    for (int i = 0; i < 40; ++i) {
+        pond.submit([] { util::sleep_for_milli(10); });
+    }
+    util::sleep_for_milli(30);
+    stream.print("thread-numb in the burst: ", pond.getExpectThreadNumb()); // 8
+    pond.waitForTasks();
+
+    // or decide the thread number by yourself
+    pond.enableAutoScaling(options, [](const ScaleSample& s) { return s.queued > s.threads ? s.threads + 1 : s.threads; });
+
+    pond.disableAutoScaling();
+}
+
+void test_thread_reserve() {
+    stream.print("\n", util::boundary('=', 11), util::strong("thread reserve"), util::boundary('=', 12));
+
+    DynamicThreadPond pond(2);
+
+    // keep 4 threads parked, growing unparks them instead of creating threads
+    pond.setThreadReserve(4);
+    stream.print("parked threads: ", pond.getParkedThreadNumb()); // 4
+
+    pond.addThreads(4);
+    pond.waitForThreads();
+    stream.print("running threads: ", pond.getRunningThreadNumb(), ", parked threads: ", pond.getParkedThreadNumb()); // 6, 0
+
+    // the shrinking threads go back to the reserve
+    pond.delThreads(4);
+    pond.waitForThreads();
+    stream.print("running threads: ", pond.getRunningThreadNumb(), ", parked threads: ", pond.getParkedThreadNumb()); // 2, 4
+}
+
+void test_cancellation() {
+    stream.print("\n", util::boundary('=', 12), util::strong("cancellation"), util::boundary('=', 13));
+
+    DynamicThreadPond pond(1);
+    CancellationToken token;
+
+    // keep the thread busy, the tasks below stay in the queue
+    pond.submit([] { util::sleep_for_milli(20); });
+    pond.submit([] { stream.print("never run"); }, token);
+
+    // or attach the token by yourself, a running task can check it to exit early
+    pond.submit(withToken(token, [] {
+        while (!CancellationToken::current()->isCancelled()) {
+            util::sleep_for_milli(1);
+        }
+    }));
+    token.cancel();
+    pond.waitForTasks();
+
+    // close the pond after the remaining tasks done, or skip them with CloseMode::cancel_and_drain
+    pond.submit([] { stream.print("drained task"); });
+    pond.close(CloseMode::drain);
+}
+
 void test_motify_thread_numb(DynamicThreadPond& pond) {
     stream.print("\n", util::boundary('=', 11), util::strong("modify threads"), util::boundary('=', 11));
 
@@ -130,6 +216,10 @@ int main() {
 
     test_submit_tasks(pond);
     test_submit_in_batch(pond);
+    test_submit_timer(pond);
+    test_auto_scaling();
+    test_thread_reserve();
+    test_cancellation();
     test_motify_thread_numb(pond);
 
     stream.print("\n", util::title("End of the test", 5));
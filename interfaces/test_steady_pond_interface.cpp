@@ -28,6 +28,9 @@ void test_submit(SteadyThreadPond& pond) {
     pond.submit(std::bind(foo2, "HanYa"));                      // std::function<void()>
     pond.submit(Functor());                                     // functor
 
+    // tasks submitted by a worker of the pond go to its local deque directly
+    pond.submit([&pond] { pond.submit([] { stream.print("nested task"); }); });
+
     // If you need return
     auto ret = pond.submitForReturn([] { return 2023; });
     stream.print("get return ", ret.get());
@@ -101,6 +104,225 @@ void test_task_overflow() {
     pond.submitInBatch(my_block, 101);
 }
 
+void test_backpressure() {
+    stream.print("\n", util::boundary('=', 11), util::strong("backpressure"), util::boundary('=', 14));
+
+    // task capacity is 4
+    SteadyThreadPond pond(2, 4);
+
+    for (int i = 0; i < 4; ++i) {
+        pond.submit([] { util::sleep_for_milli(50); });
+    }
+
+    // return false instead of overflowing
+    bool ok = pond.trySubmit([] {});
+    stream.print("try submit: ", ok); // 0
+
+    // wait for the capacity for a while
+    ok = pond.submitFor(std::chrono::milliseconds(5), [] {});
+    stream.print("submit for 5ms: ", ok); // 0
+
+    // wait until a worker finishes a task
+    pond.submitBlocking([] { stream.print("submitted after waiting"); });
+    pond.waitForTasks();
+}
+
+void test_memory_budget() {
+    stream.print("\n", util::boundary('=', 11), util::strong("memory budget"), util::boundary('=', 13));
+
+    // the task count is unlimited, but the queued tasks take at most 4KB
+    SteadyThreadPond pond(1);
+    pond.setByteBudget(4096);
+
+    // release the storage the queues kept after being idle for 100ms
+    pond.setIdleReclaim(std::chrono::milliseconds(100));
+
+    // a large callable object is counted with its heap block
+    struct {
+        char data[512];
+    } buffer = {};
+    pond.submit([] { util::sleep_for_milli(20); });
+    int refused = 0;
+    for (int i = 0; i < 20; ++i) {
+        refused += !pond.trySubmit([buffer] { (void)buffer; });
+    }
+    stream.print("queued bytes: ", pond.getQueuedBytes(), ", refused: ", refused);
+    pond.waitForTasks();
+}
+
+void test_blocking_region() {
+    stream.print("\n", util::boundary('=', 10), util::strong("blocking region"), util::boundary('=', 14));
+
+    // the stealing is disabled, so the queued tasks of a blocked worker would wait for it
+    SteadyThreadPond pond(2);
+    std::atomic_int done(0);
+    std::vector<HipeTask> tasks;
+    tasks.emplace_back([] {
+        // the other worker takes over the queued tasks while this one sleeps
+        BlockingRegion region;
+        util::sleep_for_milli(200);
+    });
+    for (int i = 0; i < 20; ++i) {
+        tasks.emplace_back([&done] { done++; });
+    }
+    pond.submitInBatch(tasks, tasks.size());
+
+    // or wrap a blocking call that returns
+    auto ret = pond.submitForReturn([] { return blocking([] { return 2023; }); });
+    stream.print("blocking call returns ", ret.get());
+    util::sleep_for_milli(50);
+    stream.print("tasks done while blocking: ", done.load()); // 20
+    pond.waitForTasks();
+}
+
+void test_task_graph(SteadyThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 12), util::strong("task graph"), util::boundary('=', 17));
+
+    // chain the futures without blocking a thread between the stages
+    auto fut = pond.submitForReturn([] { return 2023; }).then(pond, [](int year) { return year + 1; });
+    stream.print("then get ", fut.get());
+
+    // a runs before b and c, d runs after b and c
+    TaskGraph graph;
+    auto a = graph.emplace([] { stream.print("graph node a"); });
+    auto b = graph.emplace([] { stream.print("graph node b"); });
+    auto c = graph.emplace([] { stream.print("graph node c"); });
+    auto d = graph.emplace([] { stream.print("graph node d"); });
+    graph.precede(a, b);
+    graph.precede(a, c);
+    graph.precede(b, d);
+    graph.precede(c, d);
+
+    // run the graph and wait for all the nodes
+    graph.run(pond).wait();
+}
+
+void test_task_group(SteadyThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 12), util::strong("task group"), util::boundary('=', 17));
+
+    // other tasks in the pond
+    pond.submit([] { util::sleep_for_milli(100); });
+
+    // only wait for the tasks of the group
+    TaskGroup group;
+    for (int i = 0; i < 3; ++i) {
+        group.submit(pond, [i] { stream.print("group task ", i); });
+    }
+    group.wait();
+    stream.print("group done, tasks remain in the pond: ", pond.getTasksRemain()); // 1
+
+    // a task can wait for the tasks it submits, the waiting worker runs them instead of blocking
+    auto outer = pond.submitForReturn([&pond] {
+        TaskGroup inner;
+        std::atomic_int sum(0);
+        for (int i = 1; i <= 100; ++i) {
+            inner.submit(pond, [&sum, i] { sum += i; });
+        }
+        inner.wait();
+        return sum.load();
+    });
+    stream.print("nested group sum: ", outer.get()); // 5050
+
+    pond.waitForTasks();
+
+    // a task refused by a full pond is not counted into the group, and the overflow is thrown
+    SteadyThreadPond small_pond(1, 1);
+    TaskGroup refused;
+    try {
+        for (int i = 0; i < 10; ++i) {
+            refused.submit(small_pond, [] { util::sleep_for_milli(50); });
+        }
+    } catch (const std::exception& e) {
+        stream.print(e.what());
+    }
+    refused.wait();
+    stream.print("group tasks remain after the overflow: ", refused.getTasksRemain()); // 0
+}
+
+void test_completion_queue(SteadyThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 9), util::strong("completion queue"), util::boundary('=', 14));
+
+    // the results are popped in the order the tasks finish, not in the order they are submitted
+    CompletionQueue<std::string> queue;
+    for (int i = 0; i < 3; ++i) {
+        queue.submit(pond, [i] {
+            util::sleep_for_milli(30 * (3 - i));
+            return "result " + std::to_string(i);
+        });
+    }
+
+    // pop until no task is pending, the exception of a task is rethrown here
+    std::string res;
+    while (queue.pop(res)) {
+        stream.print("pop ", res); // 2 1 0
+    }
+
+    // or take all the finished results at once
+    std::vector<std::string> batch;
+    for (int i = 0; i < 4; ++i) {
+        queue.submit(pond, [i] { return "batch " + std::to_string(i); });
+    }
+    while (queue.popBatch(batch)) {
+    }
+    stream.print("popped in batches: ", batch.size()); // 4
+
+    // a task refused by a full pond leaves no result, and the overflow is thrown
+    SteadyThreadPond small_pond(1, 1);
+    CompletionQueue<int> refused;
+    int submitted = 0;
+    try {
+        for (; submitted < 10; ++submitted) {
+            refused.submit(small_pond, [] {
+                util::sleep_for_milli(50);
+                return 1;
+            });
+        }
+    } catch (const std::exception& e) {
+        stream.print(e.what());
+    }
+    int numb = 0, one = 0;
+    while (refused.pop(one)) {
+        numb++;
+    }
+    stream.print("submitted ", submitted, ", popped ", numb);
+}
+
+void test_async_stream(SteadyThreadPond& pond) {
+    stream.print("\n", util::boundary('=', 11), util::strong("async stream"), util::boundary('=', 14));
+
+    // the workers print into their own buffers, and a background thread writes them every 5ms
+    util::SyncStream logger;
+    util::AsyncLogOptions options;
+    options.flush_interval = std::chrono::milliseconds(5);
+    options.overflow = util::LogOverflow::block;
+    logger.enableAsync(options);
+
+    for (int i = 0; i < 3; ++i) {
+        pond.submit([&logger, i] { logger.print("async line ", i); });
+    }
+    pond.waitForTasks();
+
+    // wait until the lines are written
+    logger.flush();
+    logger.disableAsync();
+}
+
+void test_affinity() {
+    stream.print("\n", util::boundary('=', 13), util::strong("affinity"), util::boundary('=', 17));
+
+    // pin the workers to the cpus of one numa node before the next, the idle workers steal from the same node first
+    SteadyThreadPond compact_pond(4, 0, AffinityPolicy::compact);
+
+    // or spread them over the numa nodes
+    SteadyThreadPond scatter_pond(4, 0, AffinityPolicy::scatter);
+
+    // or pin the i-th worker to the i-th cpu in the list
+    SteadyThreadPond listed_pond(2, 0, {0, 1});
+
+    compact_pond.submit([] { stream.print("run on a pinned worker"); });
+    compact_pond.waitForTasks();
+}
+
 void test_other_interface(SteadyThreadPond& pond, int thread_numb) {
     stream.print("\n", util::boundary('=', 11), util::strong("other interface"), util::boundary('=', 13));
 
@@ -112,6 +334,22 @@ void test_other_interface(SteadyThreadPond& pond, int thread_numb) {
     util::print("disable rob tasks");
     // than we just disable this function
     pond.disableStealTasks();
+
+    util::print("enable work stealing");
+
+    // threads run tasks through lock-free local deques and the idle ones steal half of a random victim's tasks
+    pond.enableWorkStealing(thread_numb / 2);
+
+    util::print("disable work stealing");
+    pond.disableStealTasks();
+
+    util::print("park the idle threads");
+
+    // idle threads spin, yield and then sleep until new tasks arrive (nearly no cpu cost while idle)
+    pond.setWaitStrategy(WaitStrategy::spin_park);
+
+    // spin and yield forever (default, lower wake-up latency)
+    pond.setWaitStrategy(WaitStrategy::spin_yield);
 }
 
 
@@ -133,6 +371,30 @@ int main() {
     test_task_overflow();
     util::sleep_for_seconds(1);
 
+    test_backpressure();
+    util::sleep_for_seconds(1);
+
+    test_memory_budget();
+    util::sleep_for_seconds(1);
+
+    test_blocking_region();
+    util::sleep_for_seconds(1);
+
+    test_task_graph(pond);
+    util::sleep_for_seconds(1);
+
+    test_task_group(pond);
+    util::sleep_for_seconds(1);
+
+    test_completion_queue(pond);
+    util::sleep_for_seconds(1);
+
+    test_async_stream(pond);
+    util::sleep_for_seconds(1);
+
+    test_affinity();
+    util::sleep_for_seconds(1);
+
     test_other_interface(pond, 8);
     util::sleep_for_seconds(1);
 
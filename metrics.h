@@ -0,0 +1,276 @@
+#pragma once
+#include "./util.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Define HIPE_ENABLE_METRICS before including hipe to count the work of the fixed ponds' workers.
+// Nothing is counted and no memory is spent otherwise.
+#ifdef HIPE_ENABLE_METRICS
+#define HIPE_METRICS(...) __VA_ARGS__
+#else
+#define HIPE_METRICS(...)
+#endif
+
+// One of every HIPE_METRICS_SAMPLE_RATE tasks submitted by a producer is timed for the latency histograms
+#ifndef HIPE_METRICS_SAMPLE_RATE
+#define HIPE_METRICS_SAMPLE_RATE 64
+#endif
+
+namespace hipe {
+
+/**
+ * @brief Latency histogram with power-of-two buckets.
+ * The bucket i counts the latencies in [2^i, 2^(i+1)) nanoseconds, the last one also counts the longer ones.
+ */
+struct LatencyHistogram {
+    static constexpr int bucket_numb = 40;
+    uint64_t buckets[bucket_numb] = {};
+
+    static int bucketOf(uint64_t ns) {
+        int i = 0;
+        while (ns > 1 && i < bucket_numb - 1) {
+            ns >>= 1;
+            i++;
+        }
+        return i;
+    }
+
+    uint64_t count() const {
+        uint64_t ret = 0;
+        for (auto n : buckets) {
+            ret += n;
+        }
+        return ret;
+    }
+
+    /**
+     * @brief estimate a percentile
+     * @param p in [0, 1], such as 0.99
+     * @return the upper bound of the bucket holding the percentile (in nanoseconds), 0 if nothing recorded
+     */
+    uint64_t percentile(double p) const {
+        uint64_t total = count();
+        if (!total) {
+            return 0;
+        }
+        auto rank = static_cast<uint64_t>(p * static_cast<double>(total - 1));
+        uint64_t seen = 0;
+        for (int i = 0; i < bucket_numb; ++i) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return uint64_t(1) << (i + 1);
+            }
+        }
+        return uint64_t(1) << bucket_numb;
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (int i = 0; i < bucket_numb; ++i) {
+            buckets[i] += other.buckets[i];
+        }
+    }
+};
+
+
+// Counters of one worker in a snapshot
+struct WorkerStats {
+    // tasks run by the worker
+    uint64_t executed = 0;
+
+    // tasks the worker took from the others, and the others took from it
+    uint64_t stolen = 0;
+    uint64_t stolen_from = 0;
+
+    // time spent running tasks, and looking for or waiting for tasks
+    uint64_t busy_ns = 0;
+    uint64_t idle_ns = 0;
+
+    // the most tasks the worker has seen in its queues when loading tasks
+    int queue_high_water = 0;
+
+    // sampled time from submitting to starting running, and the running time
+    LatencyHistogram queue_wait;
+    LatencyHistogram run;
+};
+
+
+/**
+ * @brief Snapshot of the metrics of a pond, returned by getMetrics() if HIPE_ENABLE_METRICS is defined.
+ */
+struct PondMetrics {
+    std::vector<WorkerStats> workers;
+
+    // tasks refused because the pond was full
+    uint64_t overflow = 0;
+
+    // sum of the workers, the high-water mark is the highest one
+    WorkerStats total() const {
+        WorkerStats ret;
+        for (auto& w : workers) {
+            ret.executed += w.executed;
+            ret.stolen += w.stolen;
+            ret.stolen_from += w.stolen_from;
+            ret.busy_ns += w.busy_ns;
+            ret.idle_ns += w.idle_ns;
+            ret.queue_high_water = std::max(ret.queue_high_water, w.queue_high_water);
+            ret.queue_wait.merge(w.queue_wait);
+            ret.run.merge(w.run);
+        }
+        return ret;
+    }
+};
+
+
+namespace util {
+
+inline uint64_t nowNanos() {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * Counters of a worker, padded to its own cache lines.
+ * Most of them are only written by the worker (a relaxed load and store, no locked instruction), "stolen_from" is
+ * written by the thieves. Snapshots read them while the worker keeps running.
+ */
+class WorkerMetrics
+{
+    using Counter = std::atomic<uint64_t>;
+
+    char pad0[HIPE_CACHE_LINE];
+    Counter executed = {0};
+    Counter stolen = {0};
+    Counter busy_ns = {0};
+    Counter idle_ns = {0};
+    std::atomic_int high_water = {0};
+
+    // the time the worker entered the current state
+    Counter since = {0};
+    std::atomic<bool> busy = {false};
+
+    Counter wait_buckets[LatencyHistogram::bucket_numb] = {};
+    Counter run_buckets[LatencyHistogram::bucket_numb] = {};
+    char pad1[HIPE_CACHE_LINE];
+    Counter stolen_from = {0};
+    char pad2[HIPE_CACHE_LINE - sizeof(Counter)];
+
+    static void bump(Counter& c, uint64_t numb) {
+        c.store(c.load(std::memory_order_relaxed) + numb, std::memory_order_relaxed);
+    }
+
+public:
+    // metrics of the calling worker, nullptr if the calling thread is not a worker of the fixed ponds
+    static WorkerMetrics*& current() {
+        static thread_local WorkerMetrics* self = nullptr;
+        return self;
+    }
+
+    // called by the worker when it starts running
+    void start() {
+        since.store(nowNanos(), std::memory_order_relaxed);
+        current() = this;
+    }
+
+    void countExecuted() {
+        bump(executed, 1);
+    }
+
+    void countStolen(int numb) {
+        bump(stolen, static_cast<uint64_t>(numb));
+    }
+
+    void countStolenFrom(int numb) {
+        stolen_from.fetch_add(static_cast<uint64_t>(numb), std::memory_order_relaxed);
+    }
+
+    void observeDepth(int depth) {
+        if (depth > high_water.load(std::memory_order_relaxed)) {
+            high_water.store(depth, std::memory_order_relaxed);
+        }
+    }
+
+    // the clock is only read when the state changes
+    void toBusy() {
+        if (!busy.load(std::memory_order_relaxed)) {
+            switchState(true);
+        }
+    }
+
+    void toIdle() {
+        if (busy.load(std::memory_order_relaxed)) {
+            switchState(false);
+        }
+    }
+
+    void recordLatency(uint64_t wait_ns, uint64_t run_ns) {
+        bump(wait_buckets[LatencyHistogram::bucketOf(wait_ns)], 1);
+        bump(run_buckets[LatencyHistogram::bucketOf(run_ns)], 1);
+    }
+
+    // read the counters, the time of the current state is counted too
+    void load(WorkerStats& out) const {
+        out.executed = executed.load(std::memory_order_relaxed);
+        out.stolen = stolen.load(std::memory_order_relaxed);
+        out.stolen_from = stolen_from.load(std::memory_order_relaxed);
+        out.busy_ns = busy_ns.load(std::memory_order_relaxed);
+        out.idle_ns = idle_ns.load(std::memory_order_relaxed);
+        out.queue_high_water = high_water.load(std::memory_order_relaxed);
+
+        uint64_t from = since.load(std::memory_order_relaxed);
+        uint64_t now = nowNanos();
+        if (from && now > from) {
+            (busy.load(std::memory_order_relaxed) ? out.busy_ns : out.idle_ns) += now - from;
+        }
+        for (int i = 0; i < LatencyHistogram::bucket_numb; ++i) {
+            out.queue_wait.buckets[i] = wait_buckets[i].load(std::memory_order_relaxed);
+            out.run.buckets[i] = run_buckets[i].load(std::memory_order_relaxed);
+        }
+    }
+
+private:
+    void switchState(bool to_busy) {
+        uint64_t now = nowNanos();
+        bump(to_busy ? idle_ns : busy_ns, now - since.load(std::memory_order_relaxed));
+        since.store(now, std::memory_order_relaxed);
+        busy.store(to_busy, std::memory_order_relaxed);
+    }
+};
+
+
+// whether the task the calling producer is submitting should be timed
+inline bool sampleTask() {
+    static thread_local unsigned count = 0;
+    return ++count % HIPE_METRICS_SAMPLE_RATE == 0;
+}
+
+// a sampled task that records its queue wait and running time to the worker running it
+template <typename F>
+class TimedTask
+{
+    F foo;
+    uint64_t submitted;
+
+public:
+    template <typename T>
+    explicit TimedTask(T&& tar)
+      : foo(std::forward<T>(tar))
+      , submitted(nowNanos()) {
+    }
+
+    void operator()() {
+        uint64_t begin = nowNanos();
+        foo();
+        uint64_t end = nowNanos();
+        if (WorkerMetrics* m = WorkerMetrics::current()) {
+            m->recordLatency(begin - submitted, end - begin);
+        }
+    }
+};
+
+} // namespace util
+
+} // namespace hipe
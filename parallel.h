@@ -0,0 +1,236 @@
+#pragma once
+#include "./util.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hipe {
+
+namespace util {
+
+// get the number of working threads of any pond
+template <typename Pond>
+auto pondConcurrency(Pond& pond, int) -> decltype(pond.getThreadNumb()) {
+    return pond.getThreadNumb();
+}
+
+template <typename Pond>
+auto pondConcurrency(Pond& pond, long) -> decltype(pond.getRunningThreadNumb()) {
+    return pond.getRunningThreadNumb();
+}
+
+
+/**
+ * @brief An index range shared by the caller and the helper tasks.
+ * The range is claimed in contiguous chunks with guided self-scheduling: each chunk takes a share of the remaining
+ * range (but not less than the grain), so the chunks are large at first for locality and small at last for balance.
+ * The body is kept on the caller's stack, the caller returns only after all the helpers that got a chunk are done.
+ */
+template <typename Body>
+class ParallelRange
+{
+    std::atomic<size_t> next = {0};
+    size_t end = 0;
+    size_t grain = 1;
+    size_t parts = 1;
+
+    std::atomic_int active = {0};
+    std::atomic<bool> failed = {false};
+    std::exception_ptr error = nullptr;
+
+    Body* body = nullptr;
+
+public:
+    ParallelRange(size_t size, size_t grain, size_t parts, Body* body)
+      : end(size)
+      , grain(grain)
+      , parts(parts)
+      , body(body) {
+    }
+
+    // run chunks with the slot of the participant, called by the helpers
+    void help(size_t slot) {
+        active.fetch_add(1);
+        run(slot);
+        active.fetch_sub(1);
+    }
+
+    // run chunks with slot 0 and wait for the helpers, called by the caller
+    void join() {
+        run(0);
+        for (int i = 0; active.load(); ++i) {
+            if (i < 64) {
+                HIPE_PAUSE();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+private:
+    bool claim(size_t& beg, size_t& fin) {
+        size_t cur = next.load();
+        while (cur < end) {
+            size_t chunk = std::max(grain, (end - cur) / (2 * parts));
+            size_t stop = std::min(end, cur + chunk);
+            if (next.compare_exchange_weak(cur, stop)) {
+                beg = cur;
+                fin = stop;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void run(size_t slot) {
+        size_t beg = 0, fin = 0;
+        try {
+            while (claim(beg, fin)) {
+                (*body)(beg, fin, slot);
+            }
+        } catch (...) {
+            // keep the first exception and give up the remaining range
+            if (!failed.exchange(true)) {
+                error = std::current_exception();
+            }
+            next.store(end);
+        }
+    }
+};
+
+
+/**
+ * Run body(begin, end, slot) on chunks of [0, size) with the pond and the calling thread.
+ * The slot in [0, parts) identifies the participant, so the body can keep per-worker partial results.
+ * If the pond refuses a helper, the range is run by the participants that have been submitted.
+ */
+template <typename Pond, typename Body>
+void parallelRun(Pond& pond, size_t size, size_t grain, size_t parts, Body& body) {
+    if (parts <= 1) {
+        if (size) {
+            body(0, size, 0);
+        }
+        return;
+    }
+    auto range = std::make_shared<ParallelRange<Body>>(size, grain, parts, &body);
+    try {
+        for (size_t slot = 1; slot < parts; ++slot) {
+            pond.submit([range, slot] { range->help(slot); });
+        }
+    } catch (...) {
+        // the pond is full, the caller and the helpers submitted run the range without the others
+    }
+    range->join();
+}
+
+// number of participants for a range, the calling thread included
+template <typename Pond>
+size_t parallelParts(Pond& pond, size_t size, size_t& grain) {
+    size_t threads = static_cast<size_t>(std::max(0, static_cast<int>(pondConcurrency(pond, 0))));
+    if (!grain) {
+        grain = std::max<size_t>(1, size / ((threads + 1) * 8));
+    }
+    size_t chunks = (size + grain - 1) / grain;
+    return std::min(threads + 1, chunks);
+}
+
+} // namespace util
+
+
+/**
+ * @brief Call f(i) for each i in [begin, end) with the pond and the calling thread.
+ * The range is split adaptively into contiguous chunks, no task is created for each element.
+ * It is fine to call it inside a task of the same pond.
+ * @param grain the minimum chunk size, 0 means to choose it automatically
+ * @param f a callable object taking an index
+ */
+template <typename Pond, typename Index, typename F>
+void parallel_for(Pond& pond, Index begin, Index end, size_t grain, F&& f) {
+    if (!(begin < end)) {
+        return;
+    }
+    size_t size = static_cast<size_t>(end - begin);
+    size_t parts = util::parallelParts(pond, size, grain);
+
+    auto body = [&](size_t beg, size_t fin, size_t) {
+        for (size_t i = beg; i < fin; ++i) {
+            f(static_cast<Index>(begin + static_cast<Index>(i)));
+        }
+    };
+    util::parallelRun(pond, size, grain, parts, body);
+}
+
+template <typename Pond, typename Index, typename F>
+void parallel_for(Pond& pond, Index begin, Index end, F&& f) {
+    parallel_for(pond, begin, end, 0, std::forward<F>(f));
+}
+
+
+/**
+ * @brief Reduce [begin, end) with the pond and the calling thread.
+ * Each participant folds its chunks into its own partial result with f(chunk_begin, chunk_end, partial), and the
+ * partial results are combined at last. The combination must be associative and commutative.
+ * @param identity the initial value of every partial result
+ * @param f a callable object folding a chunk, T(Index, Index, T)
+ * @param combine a callable object combining two partial results, T(T, T)
+ */
+template <typename Pond, typename Index, typename T, typename F, typename C>
+T parallel_reduce(Pond& pond, Index begin, Index end, size_t grain, const T& identity, F&& f, C&& combine) {
+    if (!(begin < end)) {
+        return identity;
+    }
+    size_t size = static_cast<size_t>(end - begin);
+    size_t parts = util::parallelParts(pond, size, grain);
+
+    // pad the partial results to avoid false sharing
+    struct Partial {
+        T value;
+        char pad[HIPE_CACHE_LINE];
+    };
+    std::vector<Partial> partials(parts, Partial{identity, {}});
+
+    auto body = [&](size_t beg, size_t fin, size_t slot) {
+        partials[slot].value = f(static_cast<Index>(begin + static_cast<Index>(beg)), static_cast<Index>(begin + static_cast<Index>(fin)), std::move(partials[slot].value));
+    };
+    util::parallelRun(pond, size, grain, parts, body);
+
+    T result = std::move(partials[0].value);
+    for (size_t i = 1; i < parts; ++i) {
+        result = combine(std::move(result), std::move(partials[i].value));
+    }
+    return result;
+}
+
+template <typename Pond, typename Index, typename T, typename F, typename C>
+T parallel_reduce(Pond& pond, Index begin, Index end, const T& identity, F&& f, C&& combine) {
+    return parallel_reduce(pond, begin, end, 0, identity, std::forward<F>(f), std::forward<C>(combine));
+}
+
+
+/**
+ * @brief Write op(*it) to the output for each it in [first, last) with the pond and the calling thread.
+ * Both the input and the output iterators should be random-access.
+ */
+template <typename Pond, typename InputIt, typename OutputIt, typename F>
+OutputIt parallel_transform(Pond& pond, InputIt first, InputIt last, OutputIt d_first, size_t grain, F&& op) {
+    using Diff = typename std::iterator_traits<InputIt>::difference_type;
+    Diff size = std::distance(first, last);
+    parallel_for(pond, Diff(0), size, grain, [&](Diff i) { d_first[i] = op(first[i]); });
+    return d_first + size;
+}
+
+template <typename Pond, typename InputIt, typename OutputIt, typename F>
+OutputIt parallel_transform(Pond& pond, InputIt first, InputIt last, OutputIt d_first, F&& op) {
+    return parallel_transform(pond, first, last, d_first, 0, std::forward<F>(op));
+}
+
+} // namespace hipe
@@ -27,7 +27,21 @@ int main() {
     }
     pond.waitForTasks();
 
-    if (var.load() == each_task_nums * 3) {
+    // nested groups with more children than the local deques hold, the waiting workers run the queued ones
+    int outer_numb = 8, inner_numb = 300;
+    TaskGroup outer;
+    for (int k = 0; k < outer_numb; ++k) {
+        outer.submit(pond, [&] {
+            TaskGroup inner;
+            for (int i = 0; i < inner_numb; ++i) {
+                inner.submit(pond, [&] { var++; });
+            }
+            inner.wait();
+        });
+    }
+    outer.wait();
+
+    if (var.load() == each_task_nums * 3 + outer_numb * inner_numb) {
         return 0;
     } else {
         return -1;
@@ -10,39 +10,172 @@ namespace hipe {
 // thread object that support double queue replacement algorithm
 class DqThread : public ThreadBase
 {
-    std::queue<HipeTask> public_tq;
-    std::queue<HipeTask> buffer_tq;
+    // the queue whose tasks behind the running one can be handed over (see shedLoadedTasks)
+    struct TaskQueue : std::queue<HipeTask> {
+        using std::queue<HipeTask>::c;
+    };
+
+    TaskQueue public_tq;
+    TaskQueue buffer_tq;
     util::spinlock tq_locker = {};
 
+    // Preallocated lock-free queue that replaces the public queue if the capacity is limited.
+    // Producers push without locking, "tq_locker" only protects the consumer side then.
+    util::RingBuffer<HipeTask> ring_tq;
+    HipeTask ring_task;
+
 public:
+    // use a ring buffer that can hold "capacity" tasks as the public queue
+    void reserve(int capacity) {
+        ring_tq.reset(static_cast<size_t>(capacity));
+    }
+
     void runTasks() {
+        runLocalTasks();
         while (!buffer_tq.empty()) {
-            util::invoke(buffer_tq.front());
+            invokeTask(buffer_tq.front());
             buffer_tq.pop();
-            task_numb--;
+            taskDone();
+        }
+        if (ring_tq.capacity()) {
+            while (tryPopRing(ring_task)) {
+                invokeTask(ring_task);
+                taskDone();
+            }
+        }
+    }
+
+    // release the storage the empty queues kept, called by the thread itself
+    void shrinkStorage() {
+        util::spinlock_guard lock(tq_locker);
+        if (public_tq.empty()) {
+            std::queue<HipeTask>().swap(public_tq);
+        }
+        if (buffer_tq.empty()) {
+            std::queue<HipeTask>().swap(buffer_tq);
+        }
+    }
+
+    /**
+     * Move the loaded tasks behind the first one back to the public queue, where the other threads can take them.
+     * The first one may be running, and it is left in place. The loaded tasks are only the stolen ones if the public
+     * queue is a ring buffer, which they can't be pushed into, so they are left as well.
+     */
+    void shedLoadedTasks() {
+        if (ring_tq.capacity() || buffer_tq.size() < 2) {
+            return;
+        }
+        auto& loaded = buffer_tq.c;
+        util::spinlock_guard lock(tq_locker);
+        for (auto it = std::next(loaded.begin()); it != loaded.end(); ++it) {
+            public_tq.emplace(std::move(*it));
         }
+        loaded.erase(std::next(loaded.begin()), loaded.end());
+    }
+
+    // run one task that has not been loaded, for the thread waiting in a task (the loaded ones may be running)
+    bool runUnloadedTask() {
+        HipeTask tmp;
+        {
+            util::spinlock_guard lock(tq_locker);
+            if (ring_tq.capacity()) {
+                if (!ring_tq.pop(tmp)) {
+                    return false;
+                }
+            } else {
+                if (public_tq.empty()) {
+                    return false;
+                }
+                tmp = std::move(public_tq.front());
+                public_tq.pop();
+            }
+        }
+        invokeTask(tmp);
+        taskDone();
+        return true;
+    }
+
+    // take tasks from another thread and run one, for the thread waiting in a task
+    bool helpFrom(DqThread& victim) {
+        return victim.tryGiveHalfTasks(*this) && (runLocalTask() || runUnloadedTask());
     }
 
     bool tryLoadTasks() {
+        if (ring_tq.capacity()) {
+            return ring_tq.readable() || !local_tq.empty();
+        }
         tq_locker.lock();
         public_tq.swap(buffer_tq);
         tq_locker.unlock();
-        return !buffer_tq.empty();
+        return !buffer_tq.empty() || !local_tq.empty();
+    }
+
+    // (work-stealing mode) run the tasks through the local deque so that the idle threads can steal them
+    void runTasksStealable() {
+        do {
+            runLocalTasks();
+        } while (tryLoadLocalTasks());
+    }
+
+    // (work-stealing mode) move the tasks in the public queue to the local deque
+    bool tryLoadLocalTasks() {
+        if (ring_tq.capacity()) {
+            util::spinlock_guard lock(tq_locker);
+            return pullToLocal(ring_tq, localSpare(), *this) > 0;
+        }
+        if (buffer_tq.empty()) {
+            tq_locker.lock();
+            public_tq.swap(buffer_tq);
+            tq_locker.unlock();
+        }
+        return pullToLocal(buffer_tq, localSpare(), *this) > 0;
+    }
+
+    /**
+     * (work-stealing mode) give about half of the tasks to another thread.
+     * Tasks in the local deque are preferred, then the tasks that have not been loaded.
+     */
+    bool tryGiveHalfTasks(DqThread& t) {
+        if (t.stealLocalTasks(*this)) {
+            return true;
+        }
+        if (tq_locker.try_lock()) {
+            int numb = 0;
+            if (ring_tq.capacity()) {
+                numb = t.pullToLocal(ring_tq, static_cast<int>((ring_tq.size() + 1) / 2), *this);
+            } else {
+                numb = t.pullToLocal(public_tq, static_cast<int>((public_tq.size() + 1) / 2), *this);
+            }
+            tq_locker.unlock();
+            return numb > 0;
+        }
+        return false;
     }
 
     bool tryGiveTasks(DqThread& t) {
         if (tq_locker.try_lock()) {
+            if (ring_tq.capacity()) {
+                int numb = 0;
+                HipeTask tmp;
+                while (ring_tq.pop(tmp)) {
+                    t.buffer_tq.emplace(std::move(tmp));
+                    numb++;
+                }
+                tq_locker.unlock();
+                t.takeOver(*this, numb);
+                return numb > 0 || t.stealLocalTasks(*this) > 0;
+            }
             if (!public_tq.empty()) {
                 auto numb = public_tq.size();
                 public_tq.swap(t.buffer_tq);
                 tq_locker.unlock();
-                task_numb -= static_cast<int>(numb);
-                t.task_numb += static_cast<int>(numb);
+                t.takeOver(*this, static_cast<int>(numb));
                 return true;
 
             } else {
                 tq_locker.unlock();
-                return false;
+                // the tasks submitted by the thread itself
+                return t.stealLocalTasks(*this) > 0;
             }
         }
         return false;
@@ -50,18 +183,49 @@ public:
 
     template <typename T>
     void enqueue(T&& tar) {
-        util::spinlock_guard lock(tq_locker);
-        public_tq.emplace(std::forward<T>(tar));
         task_numb++;
+        push(std::forward<T>(tar));
     }
 
+    // push the tasks in [begin, end) of the container
     template <typename Container_>
-    void enqueue(Container_& cont, size_t size) {
-        util::spinlock_guard lock(tq_locker);
-        for (size_t i = 0; i < size; ++i) {
-            public_tq.emplace(std::move(cont[i]));
-            task_numb++;
+    void enqueue(Container_& cont, size_t begin, size_t end) {
+        task_numb += static_cast<int>(end - begin);
+        pushBatch(cont, begin, end);
+    }
+
+    // push the tasks in [begin, end) of the container that have been counted by reserveUpTo(), with one lock
+    template <typename Container_>
+    void pushBatch(Container_& cont, size_t begin, size_t end) {
+        if (ring_tq.capacity()) {
+            for (size_t i = begin; i < end; ++i) {
+                ring_tq.push(std::move(cont[i]));
+            }
+        } else {
+            util::spinlock_guard lock(tq_locker);
+            for (size_t i = begin; i < end; ++i) {
+                public_tq.emplace(std::move(cont[i]));
+            }
         }
+        wake();
+    }
+
+    // push a task that has been counted by tryReserve()
+    template <typename T>
+    void push(T&& tar) {
+        if (ring_tq.capacity()) {
+            ring_tq.push(std::forward<T>(tar));
+        } else {
+            util::spinlock_guard lock(tq_locker);
+            public_tq.emplace(std::forward<T>(tar));
+        }
+        wake();
+    }
+
+private:
+    bool tryPopRing(HipeTask& out) {
+        util::spinlock_guard lock(tq_locker);
+        return ring_tq.pop(out);
     }
 };
 
@@ -75,15 +239,24 @@ class SteadyThreadPond : public FixedThreadPond<DqThread>
 public:
     /**
      * @param thread_numb fixed thread number
-     * @param task_capacity task capacity of the pond, default: unlimited
+     * @param task_capacity task capacity of the pond, default: unlimited.
+     * If the capacity is limited, each thread will preallocate a lock-free ring buffer as its task queue.
+     * @param placement pin the workers by an AffinityPolicy or a cpu list, default: not pinned.
+     * The pinned workers allocate their queues on their own numa nodes.
      */
-    explicit SteadyThreadPond(int thread_numb = 0, int task_capacity = HipeUnlimited)
-      : FixedThreadPond(thread_numb, task_capacity) {
+    explicit SteadyThreadPond(int thread_numb = 0, int task_capacity = HipeUnlimited, const Placement& placement = Placement())
+      : FixedThreadPond(thread_numb, task_capacity, placement) {
         // create threads
         threads.reset(new DqThread[this->thread_numb]);
+        // the queues must be ready before any thread starts, as the workers may visit each other
+        // (the pinned workers allocate their own queues)
+        for (int i = 0; thread_cap && worker_cpu.empty() && i < this->thread_numb; ++i) {
+            threads[i].reserve(thread_cap);
+        }
         for (int i = 0; i < this->thread_numb; ++i) {
             threads[i].bindHandle(AutoThread(&SteadyThreadPond::worker, this, i));
         }
+        waitForPlacement();
     }
 
     ~SteadyThreadPond() override = default;
@@ -91,21 +264,38 @@ public:
 private:
     void worker(int index) {
         auto& self = threads[index];
+        enterWorker(self, index);
+        int idle_rounds = 0;
 
         while (!stop) {
             // yeild if no tasks
             if (self.notask()) {
+                HIPE_METRICS(self.metrics.toIdle());
                 // notify the main thread
                 if (self.isWaiting()) {
                     self.notifyTaskDone();
                     std::this_thread::yield();
                     continue;
                 }
+                // take over the tasks of a blocked worker, even if the stealing is disabled
+                if (takeBlockedTasks(self)) {
+                    continue;
+                }
                 // steal tasks from other threads
-                if (enable_steal_tasks) {
+                if (enable_steal_tasks && work_stealing) {
+                    for (int j = 0; j < max_steal; j++) {
+                        if (threads[getRandomVictim(self, j)].tryGiveHalfTasks(self)) {
+                            break;
+                        }
+                    }
+                    if (!self.notask() || self.isWaiting()) {
+                        continue;
+                    }
+                } else if (enable_steal_tasks) {
                     for (int i = index, j = 0; j < max_steal; j++) {
                         util::recyclePlus(i, 0, thread_numb);
                         if (threads[i].tryGiveTasks(self)) {
+                            HIPE_METRICS(self.metrics.toBusy());
                             self.runTasks();
                             break;
                         }
@@ -115,11 +305,19 @@ private:
                         continue;
                     }
                 }
-                std::this_thread::yield();
+                idleWait(self, idle_rounds);
 
             } else {
+                idle_rounds = 0;
+                HIPE_METRICS(self.metrics.toBusy(); self.metrics.observeDepth(self.getTasksNumb()));
+                HIPE_TRACE(self.trace.record(util::TraceKind::load, self.getTasksNumb()));
+                if (self.getTasksNumb() > 1) {
+                    wakeThief(self);
+                }
                 // run tasks
-                if (self.tryLoadTasks()) {
+                if (work_stealing) {
+                    self.runTasksStealable();
+                } else if (self.tryLoadTasks()) {
                     self.runTasks();
                 }
             }
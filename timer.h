@@ -0,0 +1,364 @@
+#pragma once
+#include "./util.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <algorithm>
+#include <vector>
+
+namespace hipe {
+
+namespace util {
+
+class TimerWheel;
+
+// a timer saved in the wheel
+struct TimerNode {
+    Task task;
+    TimerWheel* wheel = nullptr;
+
+    // expire tick, and the period (in ticks) of a periodic timer
+    uint64_t expire = 0;
+    uint64_t period = 0;
+
+    // position in the wheel, level is -1 if the timer is not in the wheel
+    TimerNode* prev = nullptr;
+    TimerNode* next = nullptr;
+    int level = -1;
+    int slot = 0;
+
+    std::atomic<bool> cancelled = {false};
+
+    // the wheel owns the armed timer through this reference
+    std::shared_ptr<TimerNode> self;
+};
+
+
+/**
+ * @brief Hierarchical timing wheel driven by one thread.
+ * There are 4 levels of 64 slots, a slot of level n covers 64^n ticks. Timers are linked into the slots
+ * intrusively, so both inserting and cancelling are O(1). The slots of the upper levels cascade down as time goes,
+ * the expired tasks of one tick are handed to the dispatcher in a batch. The thread sleeps until the next occupied slot
+ * of the lowest level or the next cascade, rather than waking up every tick.
+ * The tasks the dispatcher leaves in the batch (not moved from) are handed to it again on the next tick, so a full pond
+ * delays the timers instead of losing them.
+ */
+class TimerWheel
+{
+public:
+    using Dispatcher = std::function<void(std::vector<Task>&)>;
+
+private:
+    static constexpr int levels = 4;
+    static constexpr int slot_bits = 6;
+    static constexpr int slot_numb = 1 << slot_bits;
+    static constexpr uint64_t slot_mask = slot_numb - 1;
+
+    TimerNode* slots[levels][slot_numb] = {};
+
+    std::chrono::steady_clock::duration tick;
+    std::chrono::steady_clock::time_point start;
+    uint64_t now_tick = 0;
+
+    // number of timers in the wheel
+    size_t timer_numb = 0;
+
+    bool stop = false;
+
+    // set when a timer is added while the thread is sleeping, so that it can sleep for a shorter time
+    bool changed = false;
+
+    std::mutex locker;
+    std::condition_variable awake_cv;
+
+    Dispatcher dispatch;
+    std::thread handle;
+
+public:
+    /**
+     * @param dispatcher called by the timer thread with the expired tasks, it moves the tasks it takes
+     * @param tick_duration the precision of the wheel
+     */
+    explicit TimerWheel(Dispatcher dispatcher, std::chrono::steady_clock::duration tick_duration = std::chrono::milliseconds(1))
+      : tick(tick_duration)
+      , start(std::chrono::steady_clock::now())
+      , dispatch(std::move(dispatcher)) {
+        handle = std::thread(&TimerWheel::worker, this);
+    }
+
+    ~TimerWheel() {
+        close();
+    }
+
+    // stop the timer thread, the timers not expired will be dropped
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(locker);
+            if (stop) {
+                return;
+            }
+            stop = true;
+        }
+        awake_cv.notify_one();
+        handle.join();
+
+        std::lock_guard<std::mutex> lock(locker);
+        for (auto& level : slots) {
+            for (auto& head : level) {
+                while (head) {
+                    TimerNode* node = head;
+                    unlink(node);
+                    node->self.reset();
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief add a timer
+     * @param delay the time to wait before the first expiration
+     * @param period the period of a periodic timer, or zero for a one-shot timer
+     * @return the timer
+     */
+    template <typename F>
+    std::shared_ptr<TimerNode> add(std::chrono::steady_clock::duration delay, std::chrono::steady_clock::duration period, F&& foo) {
+        auto node = std::make_shared<TimerNode>();
+        node->task.reset(std::forward<F>(foo));
+        node->wheel = this;
+        node->period = period.count() > 0 ? std::max<uint64_t>(1, toTicks(period)) : 0;
+
+        std::lock_guard<std::mutex> lock(locker);
+        syncIfEmpty();
+        node->expire = expireAfter(toTicks(delay));
+        node->self = node;
+        insert(node.get());
+        changed = true;
+        awake_cv.notify_one();
+        return node;
+    }
+
+    /**
+     * @brief cancel a timer
+     * @return false if the timer has expired (a periodic timer will be cancelled anyway)
+     */
+    bool cancel(TimerNode* node) {
+        std::lock_guard<std::mutex> lock(locker);
+        node->cancelled.store(true);
+        if (node->level < 0) {
+            return false;
+        }
+        unlink(node);
+        // the caller holds another reference, so the node is still alive
+        node->self.reset();
+        return true;
+    }
+
+    // arm a periodic timer again after its task finished
+    void rearm(std::shared_ptr<TimerNode>&& node) {
+        std::lock_guard<std::mutex> lock(locker);
+        if (stop || node->cancelled.load()) {
+            return;
+        }
+        syncIfEmpty();
+        node->expire = expireAfter(node->period);
+        insert(node.get());
+        node->self = std::move(node);
+        changed = true;
+        awake_cv.notify_one();
+    }
+
+private:
+    uint64_t currentTick() const {
+        return static_cast<uint64_t>((std::chrono::steady_clock::now() - start) / tick);
+    }
+
+    // the clock of the wheel stops while the wheel is empty, catch up with it before adding a timer
+    void syncIfEmpty() {
+        if (!timer_numb) {
+            now_tick = std::max(now_tick, currentTick());
+        }
+    }
+
+    // the current tick has partly passed, so count from the next one
+    uint64_t expireAfter(uint64_t ticks) const {
+        return std::max(now_tick, currentTick()) + ticks + 1;
+    }
+
+    uint64_t toTicks(std::chrono::steady_clock::duration d) const {
+        // round up, so that a timer never expires early
+        return static_cast<uint64_t>((d + tick - std::chrono::steady_clock::duration(1)) / tick);
+    }
+
+    void insert(TimerNode* node) {
+        uint64_t delta = node->expire - now_tick;
+        int level = 0;
+        while (level < levels - 1 && delta >= (uint64_t(1) << (slot_bits * (level + 1)))) {
+            level++;
+        }
+        // clamp the far timers to the last slot of the top level, they will be cascaded again
+        uint64_t limit = (uint64_t(1) << (slot_bits * levels)) - 1;
+        uint64_t expire = (delta > limit) ? now_tick + limit : node->expire;
+
+        node->level = level;
+        node->slot = static_cast<int>((expire >> (slot_bits * level)) & slot_mask);
+        node->prev = nullptr;
+        node->next = slots[level][node->slot];
+        if (node->next) {
+            node->next->prev = node;
+        }
+        slots[level][node->slot] = node;
+        timer_numb++;
+    }
+
+    void unlink(TimerNode* node) {
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else {
+            slots[node->level][node->slot] = node->next;
+        }
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        node->prev = node->next = nullptr;
+        node->level = -1;
+        timer_numb--;
+    }
+
+    // move the timers of a slot to the lower levels
+    void cascade(int level, int slot) {
+        TimerNode* node = slots[level][slot];
+        while (node) {
+            TimerNode* next = node->next;
+            unlink(node);
+            insert(node);
+            node = next;
+        }
+    }
+
+    // advance one tick and collect the expired tasks
+    void advance(std::vector<Task>& expired) {
+        now_tick++;
+        for (int level = 1; level < levels; ++level) {
+            if ((now_tick & ((uint64_t(1) << (slot_bits * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(level, static_cast<int>((now_tick >> (slot_bits * level)) & slot_mask));
+        }
+
+        TimerNode* node = slots[0][now_tick & slot_mask];
+        while (node) {
+            TimerNode* next = node->next;
+            if (node->expire > now_tick) {
+                // a far timer clamped by the top level
+                unlink(node);
+                insert(node);
+            } else {
+                unlink(node);
+                if (node->period) {
+                    // the task owns the periodic timer until it is armed again
+                    std::shared_ptr<TimerNode> periodic = std::move(node->self);
+                    expired.emplace_back([periodic]() mutable {
+                        if (!periodic->cancelled.load()) {
+                            util::invoke(periodic->task);
+                        }
+                        periodic->wheel->rearm(std::move(periodic));
+                    });
+                } else {
+                    expired.emplace_back(std::move(node->task));
+                    node->self.reset();
+                }
+            }
+            node = next;
+        }
+    }
+
+    // the next tick with something to do: an occupied slot of the lowest level, or a cascade of the upper levels
+    uint64_t nextTick() const {
+        uint64_t t = now_tick + 1;
+        while ((t & slot_mask) && !slots[0][t & slot_mask]) {
+            t++;
+        }
+        return t;
+    }
+
+    void worker() {
+        // the expired tasks, and the ones left by the dispatcher
+        std::vector<Task> expired;
+
+        std::unique_lock<std::mutex> lock(locker);
+        while (!stop) {
+            if (!timer_numb && expired.empty()) {
+                // nothing to do, sleep until a timer is added
+                awake_cv.wait(lock, [this] { return stop || timer_numb; });
+                continue;
+            }
+            // the tasks left are handed over again on the next tick
+            uint64_t wake_tick = expired.empty() ? nextTick() : now_tick + 1;
+            auto next_point = start + tick * static_cast<std::chrono::steady_clock::rep>(wake_tick);
+            changed = false;
+            if (awake_cv.wait_until(lock, next_point, [this] { return stop || changed; })) {
+                // stopped, or a timer is added which may expire earlier
+                continue;
+            }
+            // catch up with the clock tick by tick, the empty wheel can jump directly
+            uint64_t target = currentTick();
+            while (now_tick < target && timer_numb) {
+                advance(expired);
+            }
+            syncIfEmpty();
+
+            if (!expired.empty()) {
+                lock.unlock();
+                try {
+                    dispatch(expired);
+                } catch (...) {
+                    // keep the tasks the dispatcher hasn't taken, and try again on the next tick
+                }
+                expired.erase(std::remove_if(expired.begin(), expired.end(), [](Task& t) { return !t.is_set(); }),
+                              expired.end());
+                lock.lock();
+            }
+        }
+    }
+};
+
+} // namespace util
+
+
+/**
+ * @brief Handle of a timer submitted by submitAfter() or submitEvery().
+ * It must not be used after the pond is destroyed.
+ */
+class TimerHandle
+{
+    std::weak_ptr<util::TimerNode> node;
+
+public:
+    TimerHandle() = default;
+
+    explicit TimerHandle(const std::shared_ptr<util::TimerNode>& timer)
+      : node(timer) {
+    }
+
+    /**
+     * @brief cancel the timer
+     * @return true if the timer is cancelled before expiring (a periodic timer will stop anyway)
+     */
+    bool cancel() {
+        auto timer = node.lock();
+        return timer && timer->wheel->cancel(timer.get());
+    }
+
+    // whether the timer is still waiting to expire
+    bool pending() const {
+        auto timer = node.lock();
+        return timer && !timer->cancelled.load();
+    }
+};
+
+} // namespace hipe
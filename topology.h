@@ -0,0 +1,243 @@
+#pragma once
+#include <algorithm>
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace hipe {
+
+namespace util {
+
+/**
+ * @brief CPUs the process is allowed to run on and the NUMA nodes they belong to.
+ * The topology is read from sysfs on Linux. On the other platforms (or if sysfs is missing) all the CPUs are
+ * regarded as one node.
+ */
+class CpuTopology
+{
+    // node of each cpu, -1 if the cpu is not allowed
+    std::vector<int> cpu_node;
+
+    // allowed cpus of each node
+    std::vector<std::vector<int>> nodes;
+
+public:
+    static const CpuTopology& get() {
+        static CpuTopology topology;
+        return topology;
+    }
+
+    int nodeNumb() const {
+        return static_cast<int>(nodes.size());
+    }
+
+    const std::vector<int>& cpusOf(int node) const {
+        return nodes[node];
+    }
+
+    // node of the cpu, 0 if unknown
+    int nodeOf(int cpu) const {
+        return (cpu >= 0 && cpu < static_cast<int>(cpu_node.size()) && cpu_node[cpu] >= 0) ? cpu_node[cpu] : 0;
+    }
+
+    // node that the calling thread is running on, -1 if unknown
+    int currentNode() const {
+#if defined(__linux__)
+        int cpu = sched_getcpu();
+        return (cpu >= 0) ? nodeOf(cpu) : -1;
+#else
+        return -1;
+#endif
+    }
+
+private:
+    CpuTopology() {
+        std::vector<int> allowed = allowedCpus();
+#if defined(__linux__)
+        for (int node = 0, missed = 0; missed < 8; ++node) {
+            std::string path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+            FILE* fp = std::fopen(path.c_str(), "r");
+            if (!fp) {
+                // node ids may be sparse
+                missed++;
+                continue;
+            }
+            char buf[1024] = {0};
+            bool ok = std::fgets(buf, sizeof(buf), fp) != nullptr;
+            std::fclose(fp);
+            if (ok) {
+                addNode(parseCpuList(buf), allowed);
+            }
+        }
+#endif
+        if (nodes.empty()) {
+            addNode(allowed, allowed);
+        }
+    }
+
+    void addNode(const std::vector<int>& cpus, const std::vector<int>& allowed) {
+        std::vector<int> group;
+        for (int cpu : cpus) {
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end()) {
+                group.push_back(cpu);
+            }
+        }
+        if (group.empty()) {
+            return;
+        }
+        for (int cpu : group) {
+            if (cpu >= static_cast<int>(cpu_node.size())) {
+                cpu_node.resize(cpu + 1, -1);
+            }
+            cpu_node[cpu] = static_cast<int>(nodes.size());
+        }
+        nodes.push_back(std::move(group));
+    }
+
+    static std::vector<int> allowedCpus() {
+        std::vector<int> cpus;
+#if defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; ++i) {
+                if (CPU_ISSET(i, &set)) {
+                    cpus.push_back(i);
+                }
+            }
+        }
+#endif
+        if (cpus.empty()) {
+            int numb = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+            for (int i = 0; i < numb; ++i) {
+                cpus.push_back(i);
+            }
+        }
+        return cpus;
+    }
+
+    // parse the list like "0-3,8-11"
+    static std::vector<int> parseCpuList(const char* str) {
+        std::vector<int> cpus;
+        int first = -1, cur = -1;
+        for (const char* p = str;; ++p) {
+            if (*p >= '0' && *p <= '9') {
+                cur = (cur < 0 ? 0 : cur * 10) + (*p - '0');
+            } else if (*p == '-') {
+                first = cur;
+                cur = -1;
+            } else {
+                if (cur >= 0) {
+                    for (int i = (first >= 0 ? first : cur); i <= cur; ++i) {
+                        cpus.push_back(i);
+                    }
+                }
+                first = cur = -1;
+                if (*p == '\0') {
+                    break;
+                }
+            }
+        }
+        return cpus;
+    }
+};
+
+
+// pin the calling thread to the cpu, return false if it is not supported or failed
+inline bool bindThisThread(int cpu) {
+#if defined(__linux__)
+    if (cpu < 0 || cpu >= CPU_SETSIZE) {
+        return false;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+} // namespace util
+
+
+/**
+ * @brief How the workers of the fixed ponds are pinned to the CPUs.
+ * none: not pinned, let the system schedule them.
+ * compact: fill the CPUs of one NUMA node before going to the next, the workers share the caches as much as possible.
+ * scatter: spread the workers over the NUMA nodes in turn, to use the memory bandwidth of all the nodes.
+ */
+enum class AffinityPolicy { none, compact, scatter };
+
+
+/**
+ * @brief Placement of the workers of the fixed ponds, either a policy or an explicit cpu list.
+ * A pinned worker allocates its local deque and, if the capacity is limited, its ring buffer after pinning, so they
+ * are placed on its own node by first touch. The task queues of an unlimited pond grow in the producers' pushes, so
+ * their memory is on the nodes of the producers.
+ */
+class Placement
+{
+    AffinityPolicy policy = AffinityPolicy::none;
+    std::vector<int> cpus;
+
+public:
+    Placement(AffinityPolicy policy = AffinityPolicy::none)
+      : policy(policy) {
+    }
+
+    // pin the i-th worker to cpus[i % cpus.size()]
+    Placement(std::vector<int> cpu_list)
+      : cpus(std::move(cpu_list)) {
+    }
+
+    Placement(std::initializer_list<int> cpu_list)
+      : cpus(cpu_list) {
+    }
+
+    // whether the workers are pinned
+    bool pinned() const {
+        return !cpus.empty() || policy != AffinityPolicy::none;
+    }
+
+    // the cpu of each worker, or an empty vector if the workers are not pinned
+    std::vector<int> cpusFor(int thread_numb) const {
+        std::vector<int> ret;
+        if (!pinned()) {
+            return ret;
+        }
+        if (!cpus.empty()) {
+            for (int i = 0; i < thread_numb; ++i) {
+                ret.push_back(cpus[i % cpus.size()]);
+            }
+            return ret;
+        }
+        const auto& topology = util::CpuTopology::get();
+        int node_numb = topology.nodeNumb();
+        if (policy == AffinityPolicy::compact) {
+            std::vector<int> all;
+            for (int n = 0; n < node_numb; ++n) {
+                all.insert(all.end(), topology.cpusOf(n).begin(), topology.cpusOf(n).end());
+            }
+            for (int i = 0; i < thread_numb; ++i) {
+                ret.push_back(all[i % all.size()]);
+            }
+        } else {
+            for (int i = 0; i < thread_numb; ++i) {
+                const auto& group = topology.cpusOf(i % node_numb);
+                ret.push_back(group[(i / node_numb) % group.size()]);
+            }
+        }
+        return ret;
+    }
+};
+
+} // namespace hipe
@@ -0,0 +1,126 @@
+#pragma once
+#include "./metrics.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+// Define HIPE_ENABLE_TRACE before including hipe to record a timeline of the fixed ponds' workers.
+// Nothing is recorded and no memory is spent otherwise.
+#ifdef HIPE_ENABLE_TRACE
+#define HIPE_TRACE(...) __VA_ARGS__
+#else
+#define HIPE_TRACE(...)
+#endif
+
+// Number of the latest events kept by each worker, a power of two
+#ifndef HIPE_TRACE_BUFFER_SIZE
+#define HIPE_TRACE_BUFFER_SIZE 16384
+#endif
+
+namespace hipe {
+
+namespace util {
+
+enum class TraceKind : uint32_t { task_begin, task_end, steal, park, wake, load, overflow };
+
+/**
+ * Ring of the latest trace events of one writer, allocated once and overwritten from the oldest.
+ * A worker checks one relaxed flag per event while the tracing is off. The slots are relaxed atomics so that a dump
+ * can read them while the worker keeps writing, stop the tracing first to get an exact capture.
+ */
+class TraceRing
+{
+    struct Slot {
+        std::atomic<uint64_t> ts = {0};
+        std::atomic<uint32_t> kind = {0};
+        std::atomic<int32_t> arg = {0};
+        std::atomic<int32_t> arg2 = {0};
+    };
+
+    static constexpr uint64_t mask = HIPE_TRACE_BUFFER_SIZE - 1;
+    static_assert((HIPE_TRACE_BUFFER_SIZE & mask) == 0, "[HipeError]: HIPE_TRACE_BUFFER_SIZE must be a power of two");
+
+    std::unique_ptr<Slot[]> slots;
+    std::atomic<uint64_t> head = {0};
+    std::atomic<bool> on = {false};
+
+public:
+    TraceRing()
+      : slots(new Slot[HIPE_TRACE_BUFFER_SIZE]) {
+    }
+
+    void enable(bool flag) {
+        on.store(flag, std::memory_order_relaxed);
+    }
+
+    // called by the only writer of the ring
+    void record(TraceKind kind, int arg = 0, int arg2 = 0) {
+        if (!on.load(std::memory_order_relaxed)) {
+            return;
+        }
+        uint64_t h = head.load(std::memory_order_relaxed);
+        Slot& s = slots[h & mask];
+        s.ts.store(nowNanos(), std::memory_order_relaxed);
+        s.kind.store(static_cast<uint32_t>(kind), std::memory_order_relaxed);
+        s.arg.store(arg, std::memory_order_relaxed);
+        s.arg2.store(arg2, std::memory_order_relaxed);
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    /**
+     * Write the events recorded since "base" (in nanoseconds) as Chrome trace events, each one begins with a comma.
+     * @param tid row of the events in the timeline
+     */
+    void write(std::ostream& os, int tid, uint64_t base) const {
+        uint64_t h = head.load(std::memory_order_acquire);
+        uint64_t from = (h > mask) ? h - mask : 0;
+        for (uint64_t i = from; i < h; ++i) {
+            const Slot& s = slots[i & mask];
+            uint64_t ts = s.ts.load(std::memory_order_relaxed);
+            if (ts < base) {
+                continue;
+            }
+            int arg = s.arg.load(std::memory_order_relaxed);
+            os << ",\n{\"pid\":1,\"tid\":" << tid << ",\"ts\":" << static_cast<double>(ts - base) / 1000.0;
+
+            switch (static_cast<TraceKind>(s.kind.load(std::memory_order_relaxed))) {
+            case TraceKind::task_begin:
+                os << ",\"ph\":\"B\",\"name\":\"task\"}";
+                break;
+            case TraceKind::task_end:
+                os << ",\"ph\":\"E\",\"name\":\"task\"}";
+                break;
+            case TraceKind::steal:
+                os << ",\"ph\":\"i\",\"s\":\"t\",\"name\":\"steal\",\"args\":{\"tasks\":" << arg
+                   << ",\"from\":" << s.arg2.load(std::memory_order_relaxed) << "}}";
+                break;
+            case TraceKind::park:
+                os << ",\"ph\":\"B\",\"name\":\"park\"}";
+                break;
+            case TraceKind::wake:
+                os << ",\"ph\":\"E\",\"name\":\"park\"}";
+                break;
+            case TraceKind::load:
+                os << ",\"ph\":\"C\",\"name\":\"queue " << tid << "\",\"args\":{\"tasks\":" << arg << "}}";
+                break;
+            case TraceKind::overflow:
+                os << ",\"ph\":\"i\",\"s\":\"t\",\"name\":\"overflow\",\"args\":{\"tasks\":" << arg << "}}";
+                break;
+            }
+        }
+    }
+};
+
+// name a row of the timeline
+inline void writeTraceName(std::ostream& os, int tid, const char* name, int numb = -1) {
+    os << ",\n{\"pid\":1,\"tid\":" << tid << ",\"ph\":\"M\",\"name\":\"thread_name\",\"args\":{\"name\":\"" << name;
+    if (numb >= 0) {
+        os << ' ' << numb;
+    }
+    os << "\"}}";
+}
+
+} // namespace util
+
+} // namespace hipe
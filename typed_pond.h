@@ -0,0 +1,337 @@
+#pragma once
+#include "header.h"
+
+namespace hipe {
+
+/**
+ * Thread object that keeps the tasks of one type by value.
+ * The queues are contiguous arrays swapped like the double queues of DqThread, the tasks are called directly so that
+ * the compiler can inline them, and the arrays keep their memory between the rounds.
+ */
+template <typename F>
+class TypedThread : public ThreadBase
+{
+    std::vector<F> public_tq;
+    std::vector<F> buffer_tq;
+    util::spinlock tq_locker = {};
+
+    // number of tasks the queues are preallocated for
+    size_t reserved = 0;
+
+    // index of the running task in "buffer_tq"
+    size_t running = 0;
+
+public:
+    // preallocate the queues for "capacity" tasks
+    void reserve(int capacity) {
+        reserved = static_cast<size_t>(capacity);
+        public_tq.reserve(reserved);
+        buffer_tq.reserve(reserved);
+    }
+
+    // bytes a task takes in the queues, the tasks are kept by value (HipeTask counts its heap block as well)
+    template <typename T>
+    static size_t bytesOf(const T& foo) {
+        return bytesOf(foo, std::is_same<F, HipeTask>());
+    }
+
+    // release the storage the empty queues kept beyond the preallocated one, called by the thread itself
+    void shrinkStorage() {
+        util::spinlock_guard lock(tq_locker);
+        for (auto q : {&public_tq, &buffer_tq}) {
+            if (q->empty() && q->capacity() > reserved) {
+                std::vector<F>().swap(*q);
+                q->reserve(reserved);
+            }
+        }
+    }
+
+    void runTasks() {
+        for (running = 0; running < buffer_tq.size(); ++running) {
+            invokeTask(buffer_tq[running]);
+            taskDone();
+        }
+        buffer_tq.clear();
+    }
+
+    // move the loaded tasks behind the running one back to the public queue, where the other threads can take them
+    void shedLoadedTasks() {
+        if (running + 1 >= buffer_tq.size()) {
+            return;
+        }
+        util::spinlock_guard lock(tq_locker);
+        for (size_t i = running + 1; i < buffer_tq.size(); ++i) {
+            public_tq.emplace_back(std::move(buffer_tq[i]));
+        }
+        while (buffer_tq.size() > running + 1) {
+            buffer_tq.pop_back();
+        }
+    }
+
+    // run one task that has not been loaded, for the thread waiting in a task (the loaded ones may be running)
+    bool runUnloadedTask() {
+        return runOneOf(*this);
+    }
+
+    // run one task of another thread, for the thread waiting in a task
+    bool helpFrom(TypedThread& victim) {
+        return runOneOf(victim);
+    }
+
+    bool tryLoadTasks() {
+        tq_locker.lock();
+        public_tq.swap(buffer_tq);
+        tq_locker.unlock();
+        return !buffer_tq.empty();
+    }
+
+    // (work-stealing mode) give about half of the tasks that have not been loaded to another thread
+    bool tryGiveHalfTasks(TypedThread& t) {
+        if (!tq_locker.try_lock()) {
+            return false;
+        }
+        int numb = static_cast<int>((public_tq.size() + 1) / 2);
+        for (int i = 0; i < numb; ++i) {
+            t.buffer_tq.emplace_back(std::move(public_tq.back()));
+            public_tq.pop_back();
+        }
+        tq_locker.unlock();
+        t.takeOver(*this, numb);
+        return numb > 0;
+    }
+
+    bool tryGiveTasks(TypedThread& t) {
+        if (!tq_locker.try_lock()) {
+            return false;
+        }
+        int numb = static_cast<int>(public_tq.size());
+        public_tq.swap(t.buffer_tq);
+        tq_locker.unlock();
+        t.takeOver(*this, numb);
+        return numb > 0;
+    }
+
+    template <typename T>
+    void enqueue(T&& tar) {
+        task_numb++;
+        push(std::forward<T>(tar));
+    }
+
+    // push the tasks in [begin, end) of the container
+    template <typename Container_>
+    void enqueue(Container_& cont, size_t begin, size_t end) {
+        task_numb += static_cast<int>(end - begin);
+        pushBatch(cont, begin, end);
+    }
+
+    // push the tasks in [begin, end) of the container that have been counted by reserveUpTo(), with one lock
+    template <typename Container_>
+    void pushBatch(Container_& cont, size_t begin, size_t end) {
+        {
+            util::spinlock_guard lock(tq_locker);
+            for (size_t i = begin; i < end; ++i) {
+                public_tq.emplace_back(std::move(cont[i]));
+            }
+        }
+        wake();
+    }
+
+    // push a task that has been counted by tryReserve()
+    template <typename T>
+    void push(T&& tar) {
+        {
+            util::spinlock_guard lock(tq_locker);
+            public_tq.emplace_back(std::forward<T>(tar));
+        }
+        wake();
+    }
+
+private:
+    // take the latest task from the public queue of a thread and run it
+    bool runOneOf(TypedThread& t) {
+        if (!t.tq_locker.try_lock()) {
+            return false;
+        }
+        if (t.public_tq.empty()) {
+            t.tq_locker.unlock();
+            return false;
+        }
+        F foo(std::move(t.public_tq.back()));
+        t.public_tq.pop_back();
+        t.tq_locker.unlock();
+        if (&t != this) {
+            takeOver(t);
+        }
+        invokeTask(foo);
+        taskDone();
+        return true;
+    }
+
+    template <typename T>
+    static size_t bytesOf(const T& foo, std::true_type) {
+        return ThreadBase::bytesOf(foo);
+    }
+
+    template <typename T>
+    static size_t bytesOf(const T&, std::false_type) {
+        return sizeof(F);
+    }
+};
+
+
+/**
+ * @brief A fixed thread pond for the tasks of one type.
+ * The tasks are kept by value instead of being wrapped in HipeTask, which saves the indirect call and keeps the queues
+ * cache-dense. It suits a pond that runs the same functor all the time, such as a packet handler.
+ * Submitting, batch submission, capacity, stealing and waiting work as SteadyThreadPond, but the interfaces that
+ * submit other kinds of tasks (submitForReturn, timers and coroutines) are not provided.
+ * Refused tasks are still handed to the refuse callback as HipeTask.
+ * @tparam F type of the tasks, a movable object called with no argument
+ */
+template <typename F>
+class TypedThreadPond : public FixedThreadPond<TypedThread<F>>
+{
+    using Base = FixedThreadPond<TypedThread<F>>;
+
+    static_assert(util::is_runnable<F>::value, "[HipeError]: The task type of TypedThreadPond must be runnable");
+
+public:
+    /**
+     * @param thread_numb fixed thread number
+     * @param task_capacity task capacity of the pond, default: unlimited.
+     * If the capacity is limited, each thread preallocates its queues.
+     * @param placement pin the workers by an AffinityPolicy or a cpu list, default: not pinned.
+     */
+    explicit TypedThreadPond(int thread_numb = 0, int task_capacity = HipeUnlimited, const Placement& placement = Placement())
+      : Base(thread_numb, task_capacity, placement) {
+        this->threads.reset(new TypedThread<F>[this->thread_numb]);
+        for (int i = 0; this->thread_cap && this->worker_cpu.empty() && i < this->thread_numb; ++i) {
+            this->threads[i].reserve(this->thread_cap);
+        }
+        for (int i = 0; i < this->thread_numb; ++i) {
+            this->threads[i].bindHandle(AutoThread(&TypedThreadPond::worker, this, i));
+        }
+        this->waitForPlacement();
+    }
+
+    ~TypedThreadPond() override = default;
+
+    /**
+     * @brief submit task
+     * @param foo a task of type F, or anything F can be constructed from
+     */
+    template <typename T>
+    void submit(T&& foo) {
+        if (!post(std::forward<T>(foo))) {
+            this->taskOverFlow(F(std::forward<T>(foo)));
+        }
+    }
+
+    // try to submit task without overflowing, return false if the pond is full
+    template <typename T>
+    bool trySubmit(T&& foo) {
+        return post(std::forward<T>(foo));
+    }
+
+    // submit task, wait for capacity if the pond is full
+    template <typename T>
+    void submitBlocking(T&& foo) {
+        if (post(std::forward<T>(foo))) {
+            return;
+        }
+        size_t bytes = this->taskBytes(foo);
+        this->capacity_freed.wait([this, bytes] { return this->admitTask(bytes); });
+        this->deliverTask(F(std::forward<T>(foo)));
+    }
+
+    // submit task, wait for capacity for a while if the pond is full, return false after the timeout
+    template <typename Rep, typename Period, typename T>
+    bool submitFor(const std::chrono::duration<Rep, Period>& timeout, T&& foo) {
+        if (post(std::forward<T>(foo))) {
+            return true;
+        }
+        size_t bytes = this->taskBytes(foo);
+        if (!this->capacity_freed.waitFor(timeout, [this, bytes] { return this->admitTask(bytes); })) {
+            return false;
+        }
+        this->deliverTask(F(std::forward<T>(foo)));
+        return true;
+    }
+
+    // submitInBatch() is inherited, the container should hold the tasks of type F
+
+private:
+    // only the tasks of type F can be kept
+    using Base::submitForReturn;
+    using Base::submitAfter;
+    using Base::submitEvery;
+    using Base::schedule;
+
+    // the tasks from the workers go through the queues as well, the threads have no local deques here
+    template <typename T>
+    bool post(T&& foo) {
+        static_assert(std::is_constructible<F, T&&>::value, "[HipeError]: The task can't be converted to the task type");
+        if (!this->admitTask(this->taskBytes(foo))) {
+            return false;
+        }
+        this->deliverTask(F(std::forward<T>(foo)));
+        return true;
+    }
+
+    void worker(int index) {
+        auto& self = this->threads[index];
+        this->enterWorker(self, index);
+        int idle_rounds = 0;
+
+        while (!this->stop) {
+            if (self.notask()) {
+                HIPE_METRICS(self.metrics.toIdle());
+                // notify the main thread
+                if (self.isWaiting()) {
+                    self.notifyTaskDone();
+                    std::this_thread::yield();
+                    continue;
+                }
+                // take over the tasks of a blocked worker, even if the stealing is disabled
+                if (this->takeBlockedTasks(self)) {
+                    self.runTasks();
+                    continue;
+                }
+                // steal tasks from other threads
+                if (this->enable_steal_tasks) {
+                    for (int i = index, j = 0; j < this->max_steal; j++) {
+                        bool got = false;
+                        if (this->work_stealing) {
+                            got = this->threads[this->getRandomVictim(self, j)].tryGiveHalfTasks(self);
+                        } else {
+                            util::recyclePlus(i, 0, this->thread_numb);
+                            got = this->threads[i].tryGiveTasks(self);
+                        }
+                        if (got) {
+                            HIPE_METRICS(self.metrics.toBusy());
+                            self.runTasks();
+                            break;
+                        }
+                    }
+                    if (!self.notask() || self.isWaiting()) {
+                        continue;
+                    }
+                }
+                this->idleWait(self, idle_rounds);
+
+            } else {
+                idle_rounds = 0;
+                HIPE_METRICS(self.metrics.toBusy(); self.metrics.observeDepth(self.getTasksNumb()));
+                HIPE_TRACE(self.trace.record(util::TraceKind::load, self.getTasksNumb()));
+                if (self.getTasksNumb() > 1) {
+                    this->wakeThief(self);
+                }
+                if (self.tryLoadTasks()) {
+                    self.runTasks();
+                }
+            }
+        }
+    }
+};
+
+} // namespace hipe
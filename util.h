@@ -1,16 +1,27 @@
 #pragma once
 #include "./compat.h"
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
+#include <new>
+#include <sstream>
 #include <string>
 #include <thread>
 #include <type_traits>
 #include <vector>
 
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
 namespace hipe {
 
 
@@ -54,31 +65,301 @@ void print(T&& t, Args&&... argv) {
     print(std::forward<Args>(argv)...);
 }
 
+// What the async SyncStream does when the buffer of a thread is full
+enum class LogOverflow { drop,
+                         block };
+
+// Options of the async mode of SyncStream
+struct AsyncLogOptions {
+    // buffer size of each printing thread in bytes, rounded up to a power of 2
+    size_t buffer_size = 64 * 1024;
+
+    // how often the background thread writes the buffered lines, it also writes once a buffer is half full
+    std::chrono::milliseconds flush_interval = std::chrono::milliseconds(10);
+
+    // drop the line or wait for the background thread if the buffer is full
+    LogOverflow overflow = LogOverflow::block;
+};
+
 /**
  * Thread sync output stream.
  * It can protect the output from multi thread competition.
+ * In the async mode, each thread formats its lines into a buffer of its own without locking, and a background thread
+ * writes the buffers to the stream in batches. The lines of one thread keep their order, but the lines of different
+ * threads may be reordered.
  */
 class SyncStream
 {
+    // lines of one thread, written by the thread and read by the background thread
+    struct LineBuffer {
+        std::unique_ptr<char[]> data;
+        size_t mask = 0;
+        std::atomic<size_t> head = {0};
+        std::atomic<size_t> tail = {0};
+
+        // the thread is writing, the async mode can't be closed
+        std::atomic<bool> writing = {false};
+
+        // format buffer, only used by the thread
+        std::ostringstream fmt;
+
+        explicit LineBuffer(size_t size) {
+            size_t cap = 1;
+            while (cap < size) {
+                cap <<= 1;
+            }
+            data.reset(new char[cap]);
+            mask = cap - 1;
+        }
+
+        size_t capacity() const {
+            return mask + 1;
+        }
+    };
+
     std::ostream& out_stream;
     std::recursive_mutex io_locker;
 
+    // unique id of the stream, as the buffers of a thread are found by it
+    uint64_t id;
+
+    std::atomic<bool> async_on = {false};
+    AsyncLogOptions options;
+    std::mutex async_locker;
+
+    // buffers of the threads, kept until the stream is destroyed
+    std::vector<std::unique_ptr<LineBuffer>> buffers;
+    std::mutex buffers_locker;
+
+    // background thread
+    std::thread flusher;
+    bool flush_stop = false;
+    std::atomic<bool> urgent = {false};
+    uint64_t flush_request = 0;
+    uint64_t flush_done = 0;
+    std::mutex flush_locker;
+    std::condition_variable flush_cv;
+    std::condition_variable done_cv;
+
+    std::atomic<uint64_t> dropped = {0};
+
 public:
     explicit SyncStream(std::ostream& out_stream = std::cout)
-      : out_stream(out_stream) {
+      : out_stream(out_stream)
+      , id(nextId()) {
     }
-    template <typename T>
-    void print(T&& items) {
-        io_locker.lock();
-        out_stream << std::forward<T>(items) << std::endl;
-        io_locker.unlock();
+
+    ~SyncStream() {
+        disableAsync();
+    }
+
+    template <typename... A>
+    void print(A&&... items) {
+        if (async_on.load(std::memory_order_acquire) && printAsync(std::forward<A>(items)...)) {
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> lock(io_locker);
+        put(out_stream, std::forward<A>(items)...);
+        out_stream << std::endl;
+    }
+
+    /**
+     * @brief start the async mode, or restart it with new options
+     * The new buffer size only applies to the threads that have never printed in the async mode.
+     */
+    void enableAsync(const AsyncLogOptions& opt = AsyncLogOptions()) {
+        disableAsync();
+        std::lock_guard<std::mutex> guard(async_locker);
+        {
+            std::lock_guard<std::mutex> lock(buffers_locker);
+            options = opt;
+            options.buffer_size = std::max<size_t>(options.buffer_size, 64);
+        }
+        flush_stop = false;
+        flusher = std::thread(&SyncStream::flushLoop, this);
+        async_on.store(true);
+    }
+
+    // write all the buffered lines and go back to the sync mode
+    void disableAsync() {
+        std::lock_guard<std::mutex> guard(async_locker);
+        if (!async_on.exchange(false)) {
+            return;
+        }
+        // wait for the threads writing the buffers (the background thread may be freeing the space for them)
+        std::vector<LineBuffer*> writers;
+        {
+            std::lock_guard<std::mutex> lock(buffers_locker);
+            for (auto& buf : buffers) {
+                writers.push_back(buf.get());
+            }
+        }
+        for (auto buf : writers) {
+            while (buf->writing.load()) {
+                std::this_thread::yield();
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(flush_locker);
+            flush_stop = true;
+        }
+        flush_cv.notify_one();
+        flusher.join();
+    }
+
+    bool isAsync() const {
+        return async_on.load(std::memory_order_relaxed);
+    }
+
+    // wait until the lines printed before are written to the stream
+    void flush() {
+        if (async_on.load()) {
+            std::unique_lock<std::mutex> lock(flush_locker);
+            uint64_t req = ++flush_request;
+            urgent.store(true);
+            flush_cv.notify_one();
+            done_cv.wait(lock, [this, req] { return flush_done >= req || flush_stop; });
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> lock(io_locker);
+        out_stream.flush();
+    }
+
+    // number of the lines dropped because of full buffers
+    uint64_t getDropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> counter(0);
+        return ++counter;
     }
+
+    static void put(std::ostream&) {
+    }
+
     template <typename T, typename... A>
-    void print(T&& item, A&&... items) {
-        io_locker.lock();
-        out_stream << std::forward<T>(item);
-        this->print(std::forward<A>(items)...);
-        io_locker.unlock();
+    static void put(std::ostream& os, T&& item, A&&... items) {
+        os << std::forward<T>(item);
+        put(os, std::forward<A>(items)...);
+    }
+
+    // buffer of the calling thread, created when it prints for the first time
+    LineBuffer& localBuffer() {
+        static thread_local std::vector<std::pair<uint64_t, LineBuffer*>> cache;
+        for (auto& c : cache) {
+            if (c.first == id) {
+                return *c.second;
+            }
+        }
+        std::lock_guard<std::mutex> lock(buffers_locker);
+        buffers.emplace_back(new LineBuffer(options.buffer_size));
+        cache.emplace_back(id, buffers.back().get());
+        return *buffers.back();
+    }
+
+    // return false if the async mode has been closed
+    template <typename... A>
+    bool printAsync(A&&... items) {
+        LineBuffer& buf = localBuffer();
+        buf.writing.store(true);
+        if (!async_on.load()) {
+            buf.writing.store(false);
+            return false;
+        }
+        buf.fmt.str(std::string());
+        put(buf.fmt, std::forward<A>(items)...);
+        buf.fmt << '\n';
+        pushLine(buf, buf.fmt.str());
+        buf.writing.store(false, std::memory_order_release);
+        return true;
+    }
+
+    void pushLine(LineBuffer& buf, const std::string& line) {
+        size_t n = line.size();
+        size_t cap = buf.capacity();
+        size_t t = buf.tail.load(std::memory_order_relaxed);
+        if (n > cap) {
+            if (options.overflow == LogOverflow::drop) {
+                dropped++;
+                return;
+            }
+            // too long for the buffer, write it directly after the lines before
+            while (buf.head.load(std::memory_order_acquire) != t) {
+                kick();
+                std::this_thread::yield();
+            }
+            std::lock_guard<std::recursive_mutex> lock(io_locker);
+            out_stream.write(line.data(), static_cast<std::streamsize>(n));
+            return;
+        }
+        while (cap - (t - buf.head.load(std::memory_order_acquire)) < n) {
+            if (options.overflow == LogOverflow::drop) {
+                dropped++;
+                return;
+            }
+            kick();
+            std::this_thread::yield();
+        }
+        size_t pos = t & buf.mask;
+        size_t first = std::min(n, cap - pos);
+        std::memcpy(buf.data.get() + pos, line.data(), first);
+        std::memcpy(buf.data.get(), line.data() + first, n - first);
+        buf.tail.store(t + n, std::memory_order_release);
+
+        if (t + n - buf.head.load(std::memory_order_relaxed) > cap / 2) {
+            kick();
+        }
+    }
+
+    // wake up the background thread before the interval ends
+    void kick() {
+        if (!urgent.exchange(true)) {
+            std::lock_guard<std::mutex> lock(flush_locker);
+            flush_cv.notify_one();
+        }
+    }
+
+    void flushLoop() {
+        std::unique_lock<std::mutex> lock(flush_locker);
+        while (true) {
+            flush_cv.wait_for(lock, options.flush_interval, [this] { return flush_stop || urgent.load(); });
+            bool quit = flush_stop;
+            uint64_t req = flush_request;
+            urgent.store(false);
+            lock.unlock();
+            writeBuffers();
+            lock.lock();
+            flush_done = req;
+            done_cv.notify_all();
+            if (quit) {
+                break;
+            }
+        }
+    }
+
+    void writeBuffers() {
+        std::lock_guard<std::mutex> lock(buffers_locker);
+        std::lock_guard<std::recursive_mutex> io_lock(io_locker);
+        bool wrote = false;
+        for (auto& buf : buffers) {
+            size_t h = buf->head.load(std::memory_order_relaxed);
+            size_t t = buf->tail.load(std::memory_order_acquire);
+            if (h == t) {
+                continue;
+            }
+            size_t pos = h & buf->mask;
+            size_t n = t - h;
+            size_t first = std::min(n, buf->capacity() - pos);
+            out_stream.write(buf->data.get() + pos, static_cast<std::streamsize>(first));
+            out_stream.write(buf->data.get(), static_cast<std::streamsize>(n - first));
+            buf->head.store(t, std::memory_order_release);
+            wrote = true;
+        }
+        if (wrote) {
+            out_stream.flush();
+        }
     }
 };
 
@@ -160,6 +441,25 @@ double timewait(F&& foo, Args&&... argv) {
 }
 
 
+/**
+ * Submit a task counted by its owner (such as a task group), without leaving it in the pond if the pond is full.
+ * The ponds that can refuse tasks are tried, so a refused task is not moved and the owner can take it back.
+ * The other ponds never overflow.
+ * @return false if the pond refused the task
+ */
+template <typename Pond, typename T, typename... Args>
+auto trySubmitCounted(Pond& pond, T& task, int, Args&&... args)
+    -> decltype(pond.trySubmit(std::move(task), std::forward<Args>(args)...)) {
+    return pond.trySubmit(std::move(task), std::forward<Args>(args)...);
+}
+
+template <typename Pond, typename T, typename... Args>
+bool trySubmitCounted(Pond& pond, T& task, long, Args&&... args) {
+    pond.submit(std::move(task), std::forward<Args>(args)...);
+    return true;
+}
+
+
 // ======================================
 //            special format
 // ======================================
@@ -222,10 +522,10 @@ inline std::string boundary(char element, int length = 10) {
 
 
 // future container
-template <typename T>
+template <typename T, typename Future_ = std::future<T>>
 class Futures
 {
-    std::vector<std::future<T>> futures;
+    std::vector<Future_> futures;
     std::vector<T> results;
 
 public:
@@ -243,11 +543,11 @@ public:
         return results;
     }
 
-    std::future<T>& operator[](size_t i) {
+    Future_& operator[](size_t i) {
         return futures[i];
     }
 
-    void push_back(std::future<T>&& future) {
+    void push_back(Future_&& future) {
         futures.push_back(std::move(future));
     }
 
@@ -300,59 +600,544 @@ public:
 };
 
 
+/**
+ * Eventcount to wait for a condition.
+ * The waiting thread sleeps on a condition variable, and the notifying thread only touches the locker when there are
+ * threads sleeping, so notifying costs an atomic load if no one is waiting.
+ * The state that the condition reads must be changed by a sequentially consistent atomic operation before notifying.
+ */
+class EventCount
+{
+    std::atomic_int waiters = {0};
+    std::mutex locker;
+    std::condition_variable cv;
+
+public:
+    template <typename Pred>
+    void wait(Pred pred) {
+        if (pred()) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(locker);
+        waiters++;
+        cv.wait(lock, pred);
+        waiters--;
+    }
+
+    // return false if the condition is still not met after the timeout
+    template <typename Rep, typename Period, typename Pred>
+    bool waitFor(const std::chrono::duration<Rep, Period>& timeout, Pred pred) {
+        if (pred()) {
+            return true;
+        }
+        std::unique_lock<std::mutex> lock(locker);
+        waiters++;
+        bool ret = cv.wait_for(lock, timeout, pred);
+        waiters--;
+        return ret;
+    }
+
+    void notifyAll() {
+        if (waiters.load()) {
+            std::lock_guard<std::mutex> lock(locker);
+            cv.notify_all();
+        }
+    }
+};
+
+
+// Most nested waits a worker helps with, the deeper ones just wait
+#ifndef HIPE_HELP_DEPTH
+#define HIPE_HELP_DEPTH 32
+#endif
+
+// Longest sleep (microseconds) of a worker that has found no task to help with for a while, doubled from 1us
+#ifndef HIPE_HELP_MAX_SLEEP
+#define HIPE_HELP_MAX_SLEEP 1000
+#endif
+
+/**
+ * Lets a worker that is waiting for something run the other tasks of its pond meanwhile, so that nested fork-join
+ * doesn't take the threads away. The ponds set it for their workers, it is empty for the other threads.
+ */
+class WorkerHelper
+{
+    using Fn = bool (*)(void*);
+    using BlockFn = void (*)(void*, bool);
+    Fn fn = nullptr;
+    BlockFn block_fn = nullptr;
+    void* arg = nullptr;
+    int depth = 0;
+
+    // nested blocking regions of the worker, only the outermost one is told to the pond
+    int blocking = 0;
+
+public:
+    static WorkerHelper& current() {
+        static thread_local WorkerHelper self;
+        return self;
+    }
+
+    /**
+     * @param foo "foo(arg)" runs one task of the pond, and returns false if there is no task for the worker
+     * @param block "block(arg, true)" tells the pond that the worker is about to block, "block(arg, false)" that the
+     * blocking is over
+     */
+    void set(Fn foo, void* tar, BlockFn block = nullptr) {
+        fn = foo;
+        arg = tar;
+        block_fn = block;
+    }
+
+    bool isWorker() const {
+        return fn != nullptr;
+    }
+
+    /**
+     * Run the tasks of the pond until the condition is met.
+     * @return false at once if the calling thread is not a worker, the caller should wait by itself
+     */
+    template <typename Pred>
+    bool helpUntil(Pred ready) {
+        if (!fn) {
+            return false;
+        }
+        depth++;
+        for (int idle = 0; !ready();) {
+            if (depth <= HIPE_HELP_DEPTH && fn(arg)) {
+                idle = 0;
+            } else if (++idle < 64) {
+                HIPE_PAUSE();
+            } else if (idle < 80) {
+                std::this_thread::yield();
+            } else {
+                // back off, so that a long wait doesn't burn the cpu
+                auto us = std::min<long>(1L << std::min(idle - 80, 16), HIPE_HELP_MAX_SLEEP);
+                std::this_thread::sleep_for(std::chrono::microseconds(us));
+            }
+        }
+        depth--;
+        return true;
+    }
+
+    // (see hipe::BlockingRegion) a worker is going to block, or has finished blocking
+    void enterBlocking() {
+        if (block_fn && !blocking++) {
+            block_fn(arg, true);
+        }
+    }
+
+    void leaveBlocking() {
+        if (block_fn && !--blocking) {
+            block_fn(arg, false);
+        }
+    }
+};
+
+
+/**
+ * Budget of the memory taken by the queued tasks of a pond.
+ * The producers reserve the bytes of a task before queueing it, and the worker gives them back once the task is done.
+ * A task is always allowed into an empty budget, so that a task larger than the budget doesn't wait forever.
+ */
+class ByteBudget
+{
+    std::atomic<size_t> limit = {0};
+    std::atomic<int64_t> used = {0};
+
+    // notified when some bytes are given back
+    EventCount* freed = nullptr;
+
+public:
+    explicit ByteBudget(EventCount* signal = nullptr)
+      : freed(signal) {
+    }
+
+    // zero means unlimited, the count starts from zero again
+    void setLimit(size_t bytes) {
+        used.store(0);
+        limit.store(bytes);
+    }
+
+    bool enabled() const {
+        return limit.load(std::memory_order_relaxed) != 0;
+    }
+
+    bool tryAcquire(size_t bytes) {
+        auto cap = static_cast<int64_t>(limit.load(std::memory_order_relaxed));
+        if (!cap || !bytes) {
+            return true;
+        }
+        auto need = static_cast<int64_t>(bytes);
+        int64_t cur = used.load(std::memory_order_relaxed);
+        do {
+            if (cur > 0 && cur + need > cap) {
+                return false;
+            }
+        } while (!used.compare_exchange_weak(cur, cur + need));
+        return true;
+    }
+
+    void release(size_t bytes) {
+        if (!bytes) {
+            return;
+        }
+        used.fetch_sub(static_cast<int64_t>(bytes));
+        if (freed) {
+            freed->notifyAll();
+        }
+    }
+
+    size_t getUsed() const {
+        return static_cast<size_t>(std::max<int64_t>(0, used.load(std::memory_order_relaxed)));
+    }
+};
+
+
+// Cache line size used to pad the data that written by different threads
+#ifndef HIPE_CACHE_LINE
+#define HIPE_CACHE_LINE 64
+#endif
+
+/**
+ * Bounded lock-free ring buffer with multiple producers and one consumer.
+ * The space is preallocated, push is wait-free as long as the buffer is not full
+ * (the caller should make sure of that, otherwise push will spin until the consumer free a slot).
+ * Only one thread is allowed to pop at the same time, use a lock if different threads may pop.
+ */
+template <typename T>
+class RingBuffer
+{
+    struct Cell {
+        std::atomic<size_t> seq;
+        T data;
+    };
+
+    char pad0[HIPE_CACHE_LINE];
+    std::atomic<size_t> tail = {0};
+    char pad1[HIPE_CACHE_LINE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> head = {0};
+    char pad2[HIPE_CACHE_LINE - sizeof(std::atomic<size_t>)];
+
+    size_t mask = 0;
+    std::unique_ptr<Cell[]> cells = {nullptr};
+
+public:
+    RingBuffer() = default;
+
+    explicit RingBuffer(size_t capacity) {
+        reset(capacity);
+    }
+
+    RingBuffer(const RingBuffer&) = delete;
+    RingBuffer& operator=(const RingBuffer&) = delete;
+
+    // renew space for at least "capacity" elements. Notice that elements in the buffer will be dropped.
+    void reset(size_t capacity) {
+        size_t sz = 2;
+        while (sz < capacity) {
+            sz <<= 1;
+        }
+        cells.reset(new Cell[sz]);
+        for (size_t i = 0; i < sz; ++i) {
+            cells[i].seq.store(i, std::memory_order_relaxed);
+        }
+        mask = sz - 1;
+        head.store(0, std::memory_order_relaxed);
+        tail.store(0, std::memory_order_release);
+    }
+
+    // the number of the slots, zero if the buffer has not been allocated
+    size_t capacity() const {
+        return cells ? mask + 1 : 0;
+    }
+
+    // approximate element number
+    size_t size() const {
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        return (t > h) ? t - h : 0;
+    }
+
+    // push an element (called by producers)
+    template <typename U>
+    void push(U&& tar) {
+        size_t pos = tail.fetch_add(1, std::memory_order_relaxed);
+        Cell& cell = cells[pos & mask];
+        while (cell.seq.load(std::memory_order_acquire) != pos) {
+            HIPE_PAUSE();
+        }
+        cell.data = std::forward<U>(tar);
+        cell.seq.store(pos + 1, std::memory_order_release);
+    }
+
+    // whether there is an element ready to be popped (called by the consumer)
+    bool readable() const {
+        size_t pos = head.load(std::memory_order_relaxed);
+        return cells[pos & mask].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // pop an element if there is one ready (called by the consumer)
+    bool pop(T& out) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell& cell = cells[pos & mask];
+        if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+            return false;
+        }
+        out = std::move(cell.data);
+        cell.seq.store(pos + mask + 1, std::memory_order_release);
+        head.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+
+// Slot number of the local deques used by the work-stealing mode of the fixed ponds
+#ifndef HIPE_LOCAL_DEQUE_SIZE
+#define HIPE_LOCAL_DEQUE_SIZE 256
+#endif
+
+/**
+ * Bounded lock-free work-stealing deque (Chase-Lev).
+ * The owner thread pushes and pops at the bottom (the last in the first out),
+ * other threads steal at the top (the first in the first out).
+ * A slot is marked as full until the task is moved out, so that the owner never overwrites a task
+ * that is still being moved by a thief.
+ */
+template <typename T>
+class WorkStealingDeque
+{
+    struct Slot {
+        std::atomic<bool> full = {false};
+        T data;
+    };
+
+    char pad0[HIPE_CACHE_LINE];
+    std::atomic<long> top = {0};
+    char pad1[HIPE_CACHE_LINE - sizeof(std::atomic<long>)];
+    std::atomic<long> bottom = {0};
+    char pad2[HIPE_CACHE_LINE - sizeof(std::atomic<long>)];
+
+    long mask = 0;
+    std::unique_ptr<Slot[]> slots = {nullptr};
+
+public:
+    WorkStealingDeque() = default;
+
+    explicit WorkStealingDeque(size_t capacity) {
+        reset(capacity);
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // renew space for at least "capacity" elements. Notice that elements in the deque will be dropped.
+    void reset(size_t capacity) {
+        size_t sz = 2;
+        while (sz < capacity) {
+            sz <<= 1;
+        }
+        slots.reset(new Slot[sz]);
+        mask = static_cast<long>(sz) - 1;
+        top.store(0, std::memory_order_relaxed);
+        bottom.store(0, std::memory_order_release);
+    }
+
+    size_t capacity() const {
+        return slots ? static_cast<size_t>(mask + 1) : 0;
+    }
+
+    // approximate element number
+    long size() const {
+        long b = bottom.load(std::memory_order_acquire);
+        long t = top.load(std::memory_order_acquire);
+        return (b > t) ? b - t : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    // push an element at the bottom (owner only), return false if the deque is full
+    template <typename U>
+    bool push(U&& tar) {
+        long b = bottom.load(std::memory_order_relaxed);
+        long t = top.load(std::memory_order_acquire);
+        if (b - t > mask) {
+            return false;
+        }
+        Slot& slot = slots[b & mask];
+        // the former task in the slot may be still moving by a thief
+        while (slot.full.load(std::memory_order_acquire)) {
+            HIPE_PAUSE();
+        }
+        slot.data = std::forward<U>(tar);
+        slot.full.store(true, std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    // pop an element at the bottom (owner only)
+    bool pop(T& out) {
+        long b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        if (t == b) {
+            // the last element, compete with thieves
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            if (!won) {
+                return false;
+            }
+        }
+        take(slots[b & mask], out);
+        return true;
+    }
+
+    // steal an element at the top (any thread)
+    bool steal(T& out) {
+        long t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        long b = bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        take(slots[t & mask], out);
+        return true;
+    }
+
+private:
+    void take(Slot& slot, T& out) {
+        while (!slot.full.load(std::memory_order_acquire)) {
+            HIPE_PAUSE();
+        }
+        out = std::move(slot.data);
+        slot.full.store(false, std::memory_order_release);
+    }
+};
+
+
+// fast pseudo random number generator (xorshift32), the state must not be zero
+inline uint32_t xorshift(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+
+// Inline buffer size of util::Task (in bytes, the vtable pointer of the wrapper included).
+// Callable objects that fit in it and can be moved without throwing will never touch the heap.
+#ifndef HIPE_TASK_INLINE_SIZE
+#define HIPE_TASK_INLINE_SIZE 48
+#endif
+
 /**
  * Task that support different kinds of callable object.
- * It will alloc some heap space to save the task.
+ * Small callable objects are saved in the inline buffer of the task,
+ * only the large ones (or the ones whose move constructor may throw) will alloc some heap space.
  */
 class Task
 {
     struct BaseExec {
         virtual void call() = 0;
+        // move construct the callable object at "dst"
+        virtual BaseExec* moveTo(void* dst) noexcept = 0;
+        virtual size_t size() const noexcept = 0;
         virtual ~BaseExec() = default;
     };
 
-    template <typename F, typename T = typename std::decay<F>::type>
+    template <typename T>
     struct GenericExec : BaseExec {
         T foo;
-        GenericExec(F&& f)
+        template <typename F>
+        explicit GenericExec(F&& f)
           : foo(std::forward<F>(f)) {
         }
         ~GenericExec() override = default;
         void call() override {
             foo();
         }
+        BaseExec* moveTo(void* dst) noexcept override {
+            return ::new (dst) GenericExec(std::move(foo));
+        }
+        size_t size() const noexcept override {
+            return sizeof(GenericExec);
+        }
     };
 
+    using Storage = typename std::aligned_storage<HIPE_TASK_INLINE_SIZE, alignof(std::max_align_t)>::type;
+
+    // whether the wrapper of the callable object can be saved in the inline buffer
+    template <typename T, typename E = GenericExec<T>>
+    using fits_inline = std::integral_constant<bool, sizeof(E) <= sizeof(Storage) && alignof(Storage) % alignof(E) == 0 &&
+                                                         std::is_nothrow_move_constructible<T>::value>;
+
 public:
     Task() = default;
-    Task(Task&& other) = default;
+
+    Task(Task&& other) noexcept {
+        take(other);
+    }
 
     Task(Task&) = delete;
     Task(const Task&) = delete;
     Task& operator=(const Task&) = delete;
 
-    ~Task() = default;
+    ~Task() {
+        destroy();
+    }
 
     // construct a task
     template <typename F, typename = typename std::enable_if<is_runnable<F>::value>::type>
-    Task(F&& foo)
-      : exe(new GenericExec<F>(std::forward<F>(foo))) {
+    Task(F&& foo) {
+        construct(std::forward<F>(foo));
     }
 
     // reset the task
     template <typename F, typename = typename std::enable_if<is_runnable<F>::value>::type>
     void reset(F&& foo) {
-        exe.reset(new GenericExec<F>(std::forward<F>(foo)));
+        destroy();
+        construct(std::forward<F>(foo));
     }
 
     // the task was set
     bool is_set() {
-        return static_cast<bool>(exe);
+        return exe != nullptr;
+    }
+
+    // whether the callable object is saved in the inline buffer
+    bool is_inline() const {
+        return exe && isLocal();
+    }
+
+    // memory the task takes, the task itself and the heap block of a large callable object (not what it points to)
+    size_t footprint() const {
+        return (exe && !isLocal()) ? sizeof(Task) + exe->size() : sizeof(Task);
+    }
+
+    // footprint of a task holding a callable object of type F
+    template <typename F, typename T = typename std::decay<F>::type>
+    static constexpr size_t footprintOf() {
+        return fits_inline<T>::value ? sizeof(Task) : sizeof(Task) + sizeof(GenericExec<T>);
     }
 
     // override "="
-    Task& operator=(Task&& tmp) {
-        exe.reset(tmp.exe.release());
+    Task& operator=(Task&& tmp) noexcept {
+        if (this != &tmp) {
+            destroy();
+            take(tmp);
+        }
         return *this;
     }
 
@@ -362,10 +1147,72 @@ public:
     }
 
 private:
-    std::unique_ptr<BaseExec> exe = nullptr;
+    template <typename F, typename T = typename std::decay<F>::type>
+    typename std::enable_if<fits_inline<T>::value>::type construct(F&& foo) {
+        exe = ::new (&buf) GenericExec<T>(std::forward<F>(foo));
+    }
+
+    template <typename F, typename T = typename std::decay<F>::type>
+    typename std::enable_if<!fits_inline<T>::value>::type construct(F&& foo) {
+        exe = new GenericExec<T>(std::forward<F>(foo));
+    }
+
+    bool isLocal() const {
+        auto p = reinterpret_cast<const char*>(exe);
+        auto b = reinterpret_cast<const char*>(&buf);
+        return p >= b && p < b + sizeof(Storage);
+    }
+
+    void take(Task& other) noexcept {
+        if (!other.exe) {
+            return;
+        }
+        if (other.isLocal()) {
+            exe = other.exe->moveTo(&buf);
+            other.exe->~BaseExec();
+        } else {
+            exe = other.exe;
+        }
+        other.exe = nullptr;
+    }
+
+    void destroy() noexcept {
+        if (!exe) {
+            return;
+        }
+        if (isLocal()) {
+            exe->~BaseExec();
+        } else {
+            delete exe;
+        }
+        exe = nullptr;
+    }
+
+private:
+    BaseExec* exe = nullptr;
+    Storage buf;
 };
 
 
+// return the free heap memory to the system, only supported with glibc
+inline void trimHeap() {
+#if defined(__GLIBC__)
+    malloc_trim(0);
+#endif
+}
+
+
+// memory a queued task takes, the tasks kept by value only take their own size
+inline size_t storedBytes(const Task& task) {
+    return task.footprint();
+}
+
+template <typename T>
+size_t storedBytes(const T&) {
+    return sizeof(T);
+}
+
+
 /**
  * Block for adding tasks in batch
  * You can regard it as a more convenient C arrays